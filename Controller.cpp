@@ -0,0 +1,88 @@
+/* 
+ * The following classes implement the control laws that translate
+ * the angular error of a joint into a speed for its movement object.
+ *
+ * PIDController is a parallel PID with the derivative computed on the
+ * measurement (no kicks on reference steps) and low pass filtered, or
+ * taken straight from the sensor velocity estimate when there is one, the
+ * integral term is clamped and frozen while the output is saturated
+ * (anti-windup), and velocity and acceleration feed-forward terms let a
+ * trajectory drive the joint without waiting for an error to build up.
+ *
+ * References:
+ * http://brettbeauregard.com/blog/2011/04/improving-the-beginners-pid-introduction/
+ * https://www.cds.caltech.edu/~murray/books/AM08/pdf/am08-pid_04Mar10.pdf
+ *
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "Controller.h"
+
+/* Actuation effort is a speed percentage */
+#define output_limit (double)100.0
+
+
+PIDController::PIDController(const Gains &gains) : _gains(gains)
+{
+    Reset();
+}
+
+
+PIDController::~PIDController(void)
+{
+    return;
+}
+
+
+void PIDController::Reset(void)
+{
+    _integral = 0;
+    _derivative = 0;
+    _previous_measured = 0;
+    _first_update = true;
+}
+
+
+double PIDController::Update(const double &error,
+                             const double &measured,
+                             const double &dt,
+                             const double &reference_velocity,
+                             const double &reference_acceleration,
+                             const double &measured_velocity)
+{
+    /* Derivative on measurement, angles wrap so use the shortest delta */
+    if (!std::isnan(measured_velocity)) {
+        /* Edge timed estimates are clean already, no need to differentiate */
+        _derivative = -measured_velocity;
+    } else if (_first_update || dt <= 0) {
+        _first_update = false;
+    } else {
+        const double rate = -std::remainder(measured - _previous_measured, 360.0) / dt;
+        /* First order low pass to keep encoder quantization out of the output */
+        const double tau = 1.0 / (2.0 * M_PI * _gains.derivative_cutoff_hz);
+        _derivative += (dt / (dt + tau)) * (rate - _derivative);
+    }
+    _previous_measured = measured;
+
+    /* Everything but the integral, used to decide if we are saturated */
+    double output = _gains.kp * error
+                  + _gains.kd * _derivative
+                  + _gains.kv * reference_velocity
+                  + _gains.ka * reference_acceleration;
+
+    /* Anti-windup: only integrate when it does not push further into saturation */
+    const double candidate = _integral + _gains.ki * error * dt;
+    const double unclamped = output + candidate;
+    if ((std::abs(unclamped) < output_limit) || (unclamped * error < 0)) {
+        _integral = std::max(-_gains.integral_limit,
+                             std::min(candidate, _gains.integral_limit));
+    }
+    output += _integral;
+
+    /* Overcome the static friction in the direction we want to move */
+    if (output > 0)      output += _gains.ks;
+    else if (output < 0) output -= _gains.ks;
+
+    return std::max(-output_limit, std::min(output, output_limit));
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cmath>
+
+
+class AngularController
+{
+    public:
+        virtual ~AngularController(void) {}
+
+        /* Returns the signed actuation effort in % for the given error,
+         * positive values rotate the joint counter-clockwise (CCW). The
+         * measured velocity is NAN when the sensor cannot provide one */
+        virtual double Update(const double &error,
+                              const double &measured,
+                              const double &dt,
+                              const double &reference_velocity = 0,
+                              const double &reference_acceleration = 0,
+                              const double &measured_velocity = NAN) = 0;
+        virtual void Reset(void) = 0;
+};
+
+
+class PIDController : public AngularController
+{
+    public:
+        struct Gains {
+            /* Proportional, integral and derivative terms */
+            double kp, ki, kd;
+            /* Velocity and acceleration feed-forward terms */
+            double kv, ka;
+            /* Static friction compensation, in % of speed */
+            double ks;
+            /* Maximum contribution of the integral term, in % of speed */
+            double integral_limit;
+            /* Cut-off frequency of the derivative low pass filter */
+            double derivative_cutoff_hz;
+        };
+
+        explicit PIDController(const Gains &gains);
+        virtual ~PIDController(void);
+
+        double Update(const double &error,
+                      const double &measured,
+                      const double &dt,
+                      const double &reference_velocity = 0,
+                      const double &reference_acceleration = 0,
+                      const double &measured_velocity = NAN);
+        void Reset(void);
+
+    private:
+        const Gains _gains;
+
+        /* Internal state, only touched by the control loop */
+        double _integral;
+        double _derivative;
+        double _previous_measured;
+        bool _first_update;
+};
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <boost/timer/timer.hpp>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <new>
+#include "../toolbox.h"
+#include "../RoboticArm.h"
+#include "../Trajectory.h"
+#include "../TrajectoryFile.h"
+#include "../RoboticArm_Config.h"
+
+/* Rate at which references are issued and the response is sampled */
+#define BENCHMARK_RATE_HZ 1000
+/* A step response is settled once it stays within this fraction of the step */
+#define SETTLING_BAND 0.02
+/* Time given to the arm to reach the start of a recorded path, unmeasured */
+#define APPROACH_TIME_S 1.0
+
+/* Heap allocations of the whole process, every thread included. The control
+ * path runs with its memory locked, so the measured loops are expected to make none */
+std::atomic<unsigned long long> heap_allocations(0);
+
+/* Both kept out of line, once inlined GCC sees malloc() paired with delete */
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    heap_allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+std::unique_ptr<RoboticArm> RoboArm;
+
+/* Global command line knobs */
+std::string cl_option_filename;
+std::string cl_option_output("benchmark.json");
+double cl_option_step = 30;
+double cl_option_ramp = 45;
+double cl_option_time = 5;
+
+/* Generates the joint references in radians, t seconds into the workload */
+typedef std::function<void(const double &t, JointVector &theta,
+                           JointVector &velocity)> ReferenceGenerator;
+
+/* Percentiles of one of the latency histograms of a joint, in nanoseconds */
+struct LatencyResult
+{
+    uint64_t p50, p99, p999, max;
+
+    explicit LatencyResult(void) : p50(0), p99(0), p999(0), max(0) {}
+    explicit LatencyResult(const toolbox::histogram &h) :
+        p50(h.percentile(50)), p99(h.percentile(99)), p999(h.percentile(99.9)), max(h.max()) {}
+};
+
+/* Closed loop response of one joint along one workload */
+struct JointResult
+{
+    double settling_time;
+    double overshoot;
+    double rms_error;
+    double max_error;
+    unsigned long long missed_deadlines;
+    double cpu_utilisation;
+    uint64_t period_p50, period_p90, period_p99, period_p999, period_max;
+    LatencyResult wakeup, compute, actuation;
+};
+
+struct WorkloadResult
+{
+    std::string name;
+    double duration;
+    double executor_cpu_utilisation;
+    /* Cartesian distance between the reference and the measured position */
+    double max_position_error;
+    unsigned long long allocations;
+    std::vector<JointResult> joints;
+};
+
+
+void Shutdown(int signum)
+{
+    logger << "I: Caught signal " << signum << std::endl;
+
+    /* Calling the destructor explicitly */
+    RoboArm.reset();
+
+    std::exit(signum);
+}
+
+void PrintUsage()
+{
+    const std::string usage                                   \
+("                                                          \n\
+Usage: linux-robotic-arm-benchmark.app -o FILE -t 5         \n\
+Measures the closed loop response of the robotic arm.       \n\
+                                                            \n\
+    -o,--output=   JSON report file (default benchmark.json)\n\
+    -t,--time=     Seconds per workload (default 5)         \n\
+    -s,--step=     Step workload size in degrees (30)       \n\
+    -r,--ramp=     Ramp workload speed in degrees/s (45)    \n\
+    -f,--file=     Trajectory file for the path workload    \n\
+    -h,--help      Prints the usage and exit (this screen)  \n\
+                                                            \n\
+                                                            \n\
+Example:                                                    \n\
+linux-robotic-arm-benchmark.app -f trajectory.rec -t 10     \n\
+");
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void ProcessCLI(int argc, char *argv[])
+{
+    int c, option_index = 0;
+
+    struct option long_options[] = {
+        { "output"  , required_argument , NULL, 'o'},
+        { "time"    , required_argument , NULL, 't'},
+        { "step"    , required_argument , NULL, 's'},
+        { "ramp"    , required_argument , NULL, 'r'},
+        { "file"    , required_argument , NULL, 'f'},
+        { "help"    , no_argument       , NULL, 'h'},
+        { 0         , 0                 , NULL,  0 }
+    };
+
+    while ((c = getopt_long(argc, argv, "o:t:s:r:f:h", long_options, &option_index)) != -1)
+        switch(c) {
+
+            case 'o':
+                cl_option_output.assign(optarg);
+                break;
+
+            case 't':
+                cl_option_time = atof(optarg);
+                if (cl_option_time <= 0) PrintUsage();
+                break;
+
+            case 's':
+                cl_option_step = atof(optarg);
+                break;
+
+            case 'r':
+                cl_option_ramp = atof(optarg);
+                break;
+
+            case 'f':
+                cl_option_filename.assign(optarg);
+                break;
+
+            case 'h':
+            case '?':
+            default:
+                PrintUsage();
+
+        }
+}
+
+/* A Cartesian workload queues the position of each reference instead of its
+ * angles, through inverse kinematics like a Cartesian client would */
+WorkloadResult RunWorkload(const std::string &name, const double &duration,
+                           const double &step, const ReferenceGenerator &reference,
+                           const bool &cartesian = false)
+{
+    const int joints_nr = config::joints_nr;
+    const auto period = std::chrono::nanoseconds((long)(1E09 / BENCHMARK_RATE_HZ));
+
+    WorkloadResult result;
+    result.name = name;
+    result.duration = duration;
+    result.joints.resize(joints_nr);
+
+    /* Running error statistics, errors are in degrees */
+    JointVector theta = JointVector(), velocity = JointVector(), actual;
+    Point target = Point(), position = Point(), goal = Point();
+    double max_position_error = 0;
+    std::vector<double> sum_squares(joints_nr, 0), peak_error(joints_nr, 0);
+    std::vector<double> overshoot(joints_nr, 0), last_unsettled(joints_nr, 0);
+    std::vector<double> cpu_start(joints_nr);
+    std::vector<unsigned long long> missed_start(joints_nr);
+    unsigned long long samples = 0;
+
+    /* Only what happens during this workload is accounted for */
+    for(auto id = 0; id < joints_nr; id++) {
+        auto joint = RoboArm->GetJoint(id);
+        joint->GetLoopPeriods().reset();
+        joint->GetWakeupLatencies().reset();
+        joint->GetComputeTimes().reset();
+        joint->GetActuationTimes().reset();
+        cpu_start[id] = joint->GetCPUTime();
+        missed_start[id] = joint->GetMissedDeadlines();
+    }
+    const double executor_cpu_start = RoboArm->GetCPUTime();
+
+    logger << "I: Running the " << name << " workload for " << duration << "s" << std::endl;
+
+    toolbox::periodic_timer timer(period.count());
+    const auto start_time = std::chrono::steady_clock::now();
+    const unsigned long long allocations_start = heap_allocations;
+
+    for(;;) {
+
+        const auto now = std::chrono::steady_clock::now();
+        const double t = std::chrono::duration<double>(now - start_time).count();
+        if (t >= duration) break;
+
+        /* The previous reference has been in effect for a whole period */
+        if (samples++) {
+            RoboArm->GetAngles(actual);
+            for(auto id = 0; id < joints_nr; id++) {
+                const double error = std::remainder((theta[id] - actual[id]) * 180.0 / M_PI, 360.0);
+                sum_squares[id] += error * error;
+                peak_error[id] = std::max(peak_error[id], std::fabs(error));
+                /* Going past the target flips the sign of the error */
+                if (step != 0) {
+                    overshoot[id] = std::max(overshoot[id], -error / step * 100.0);
+                    if (std::fabs(error) > std::fabs(step) * SETTLING_BAND) last_unsettled[id] = t;
+                }
+            }
+            /* Same path a Cartesian client goes through, kinematics included */
+            RoboArm->ForwardKinematics(target, theta);
+            RoboArm->GetPosition(position);
+            max_position_error = std::max(max_position_error,
+                                          std::sqrt((target.x - position.x) * (target.x - position.x) +
+                                                    (target.y - position.y) * (target.y - position.y) +
+                                                    (target.z - position.z) * (target.z - position.z)));
+        }
+
+        reference(t, theta, velocity);
+        if (cartesian) {
+            RoboArm->ForwardKinematics(goal, theta);
+            RoboArm->QueuePosition(goal, now);
+        } else {
+            RoboArm->QueueAngles(now, theta, velocity);
+        }
+
+        timer.wait();
+
+    }
+
+    result.allocations = heap_allocations - allocations_start;
+    result.max_position_error = max_position_error;
+
+    const double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                           - start_time).count();
+
+    for(auto id = 0; id < joints_nr; id++) {
+        auto joint = RoboArm->GetJoint(id);
+        auto &periods = joint->GetLoopPeriods();
+        auto &joint_result = result.joints[id];
+
+        joint_result.settling_time = last_unsettled[id];
+        joint_result.overshoot = overshoot[id];
+        joint_result.rms_error = (samples > 1) ? std::sqrt(sum_squares[id] / (samples - 1)) : 0;
+        joint_result.max_error = peak_error[id];
+        joint_result.missed_deadlines = joint->GetMissedDeadlines() - missed_start[id];
+        joint_result.cpu_utilisation = (joint->GetCPUTime() - cpu_start[id]) / wall_time;
+        joint_result.period_p50 = periods.percentile(50);
+        joint_result.period_p90 = periods.percentile(90);
+        joint_result.period_p99 = periods.percentile(99);
+        joint_result.period_p999 = periods.percentile(99.9);
+        joint_result.period_max = periods.max();
+        joint_result.wakeup = LatencyResult(joint->GetWakeupLatencies());
+        joint_result.compute = LatencyResult(joint->GetComputeTimes());
+        joint_result.actuation = LatencyResult(joint->GetActuationTimes());
+    }
+    result.executor_cpu_utilisation = (RoboArm->GetCPUTime() - executor_cpu_start) / wall_time;
+
+    return result;
+}
+
+void WriteReport(std::ostream &out, const std::vector<WorkloadResult> &results)
+{
+    /* Loop periods are collected in nanoseconds and reported in microseconds */
+    auto us = [](const uint64_t &ns) { return ns / 1E03; };
+    auto latency = [&](const LatencyResult &l) {
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(3) << "{ "
+             << "\"p50\": " << us(l.p50) << ", "
+             << "\"p99\": " << us(l.p99) << ", "
+             << "\"p99.9\": " << us(l.p999) << ", "
+             << "\"max\": " << us(l.max) << " }";
+        return line.str();
+    };
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"control_loop_rate_hz\": " << config::control_loop_rate_hz << ",\n";
+    out << "  \"shared_control_thread\": " << (config::shared_control_thread ? "true" : "false") << ",\n";
+    out << "  \"event_driven_control\": " << (config::event_driven_control ? "true" : "false") << ",\n";
+#ifdef SIMULATED_PLANT
+    out << "  \"simulated_plant\": true,\n";
+#else
+    out << "  \"simulated_plant\": false,\n";
+#endif
+    out << "  \"workloads\": [\n";
+
+    for(size_t w = 0; w < results.size(); w++) {
+        const auto &result = results[w];
+        const bool step = (result.name == "step");
+
+        out << "    {\n";
+        out << "      \"name\": \"" << result.name << "\",\n";
+        out << "      \"duration_s\": " << result.duration << ",\n";
+        out << "      \"executor_cpu_utilisation\": " << result.executor_cpu_utilisation << ",\n";
+        out << "      \"max_position_error_mm\": " << result.max_position_error * 1E03 << ",\n";
+        out << "      \"heap_allocations\": " << result.allocations << ",\n";
+        out << "      \"joints\": [\n";
+
+        for(size_t id = 0; id < result.joints.size(); id++) {
+            const auto &joint = result.joints[id];
+            out << "        {\n";
+            out << "          \"id\": " << id << ",\n";
+            if (step) {
+                /* A response that never entered the band has no settling time */
+                if (joint.settling_time < result.duration * 0.95) {
+                    out << "          \"settling_time_s\": " << joint.settling_time << ",\n";
+                } else {
+                    out << "          \"settling_time_s\": null,\n";
+                }
+                out << "          \"overshoot_pct\": " << joint.overshoot << ",\n";
+            }
+            out << "          \"rms_error_deg\": " << joint.rms_error << ",\n";
+            out << "          \"max_error_deg\": " << joint.max_error << ",\n";
+            out << "          \"missed_deadlines\": " << joint.missed_deadlines << ",\n";
+            out << "          \"cpu_utilisation\": " << joint.cpu_utilisation << ",\n";
+            out << "          \"loop_period_us\": { "
+                << "\"p50\": " << us(joint.period_p50) << ", "
+                << "\"p90\": " << us(joint.period_p90) << ", "
+                << "\"p99\": " << us(joint.period_p99) << ", "
+                << "\"p99.9\": " << us(joint.period_p999) << ", "
+                << "\"max\": " << us(joint.period_max) << " },\n";
+            out << "          \"wakeup_latency_us\": " << latency(joint.wakeup) << ",\n";
+            out << "          \"compute_us\": " << latency(joint.compute) << ",\n";
+            out << "          \"actuation_us\": " << latency(joint.actuation) << "\n";
+            out << "        }" << ((id + 1 < result.joints.size()) ? "," : "") << "\n";
+        }
+
+        out << "      ]\n";
+        out << "    }" << ((w + 1 < results.size()) ? "," : "") << "\n";
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<WorkloadResult> results;
+    JointVector start;
+
+    /* Process the arguments, all of them are optional */
+    ProcessCLI(argc, argv);
+
+    /* Please check RoboticArtm_Config.h for number of joints*/
+    RoboArm = std::unique_ptr<RoboticArm>(new RoboticArm());
+
+    /* Register a signal handler to exit gracefully */
+    signal(SIGINT, Shutdown);
+
+    RoboArm->Init();
+
+    /* Step, every joint jumps by the same amount and holds there. It is
+     * queued as a position so the inverse kinematics run in the measured
+     * window, and their heap use is accounted for too */
+    RoboArm->GetAngles(start);
+    const double step = cl_option_step / 180.0 * M_PI;
+    results.push_back(RunWorkload("step", cl_option_time, cl_option_step,
+        [&](const double &, JointVector &theta, JointVector &velocity) {
+            velocity.fill(0);
+            for(size_t id = 0; id < start.size(); id++) theta[id] = start[id] + step;
+        }, true));
+
+    /* Ramp, every joint moves at a constant speed with velocity feed-forward */
+    RoboArm->GetAngles(start);
+    const double ramp = cl_option_ramp / 180.0 * M_PI;
+    results.push_back(RunWorkload("ramp", cl_option_time, 0,
+        [&](const double &t, JointVector &theta, JointVector &velocity) {
+            velocity.fill(ramp);
+            for(size_t id = 0; id < start.size(); id++) theta[id] = start[id] + ramp * t;
+        }));
+
+    /* Recorded path, sampled from the same interpolation used for playback */
+    if (!cl_option_filename.empty()) {
+        Trajectory path;
+        JointVector acceleration;
+
+        logger << "I: Loading trajectory file: \"" << cl_option_filename << "\"" << std::endl;
+        if (TrajectoryReader::IsBinary(cl_option_filename)) {
+            TrajectoryReader file(cl_option_filename);
+            path.Load(*RoboArm, file);
+        } else {
+            std::vector<std::pair<Point, double>> trajectory;
+            if (!ParseTrajectoryText(cl_option_filename, trajectory)) exit(EXIT_FAILURE);
+            path.Load(*RoboArm, trajectory);
+        }
+
+        /* Bring the arm to the beginning of the path before measuring */
+        JointVector theta, velocity;
+        path.Sample(0, theta, velocity, acceleration);
+        RoboArm->QueueAngles(std::chrono::steady_clock::now(), theta);
+        std::this_thread::sleep_for(std::chrono::duration<double>(APPROACH_TIME_S));
+
+        results.push_back(RunWorkload("trajectory", std::min(cl_option_time, path.GetDuration()), 0,
+            [&](const double &t, JointVector &theta, JointVector &velocity) {
+                path.Sample(t, theta, velocity, acceleration);
+            }));
+    }
+
+    /* Stop the control loops before reporting, nothing moves from here on */
+    RoboArm.reset();
+
+    std::ofstream report(cl_option_output);
+    if (!report) {
+        logger << "E: Unable to write the benchmark report \"" << cl_option_output << "\"" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    WriteReport(report, results);
+
+    logger << "I: Benchmark report written to \"" << cl_option_output << "\"" << std::endl;
+
+    /* Steady state control must not touch the heap, fail loudly if it did */
+    for(auto &result : results) {
+        if (result.allocations) {
+            logger << "E: The " << result.name << " workload made " << result.allocations
+                   << " heap allocations" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "../toolbox.h"
+#include "../TrajectoryFile.h"
+
+
+/* Global command line knobs */
+std::string cl_option_input;
+std::string cl_option_output;
+
+void PrintUsage()
+{
+    const std::string usage                                   \
+("                                                          \n\
+Usage: linux-robotic-arm-converter.app -i FILE -o FILE      \n\
+Converts a text trajectory into the binary format.          \n\
+                                                            \n\
+    -i,--input=    Text trajectory file (x y z t per line)  \n\
+    -o,--output=   Binary trajectory file to create         \n\
+    -h,--help      Prints the usage and exit (this screen)  \n\
+                                                            \n\
+                                                            \n\
+Example:                                                    \n\
+linux-robotic-arm-converter.app -i trajectory.rec -o trajectory.bin\n\
+");
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void ProcessCLI(int argc, char *argv[])
+{
+    int c, option_index = 0;
+
+    struct option long_options[] = {
+        { "input"   , required_argument , NULL, 'i'},
+        { "output"  , required_argument , NULL, 'o'},
+        { "help"    , no_argument       , NULL, 'h'},
+        { 0         , 0                 , NULL,  0 }
+    };
+
+    if (argc < 3)
+        PrintUsage();
+
+    while ((c = getopt_long(argc, argv, "i:o:h", long_options, &option_index)) != -1)
+        switch(c) {
+
+            case 'i':
+                cl_option_input.assign(optarg);
+                break;
+
+            case 'o':
+                cl_option_output.assign(optarg);
+                break;
+
+            case 'h':
+            case '?':
+            default:
+                PrintUsage();
+
+        }
+
+    if (cl_option_input.empty() || cl_option_output.empty())
+        PrintUsage();
+}
+
+int main(int argc, char *argv[])
+{
+    ProcessCLI(argc, argv);
+
+    logger << "I: Converting \"" << cl_option_input << "\" into \"" << cl_option_output << "\"" << std::endl;
+
+    try {
+        if (!ConvertTrajectoryText(cl_option_input, cl_option_output)) return EXIT_FAILURE;
+    } catch(const std::runtime_error &e) {
+        logger << "E: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
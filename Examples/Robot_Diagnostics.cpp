@@ -2,8 +2,6 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sched.h>
-#include <sys/mman.h>
 #include <boost/timer/timer.hpp>
 #include <iomanip>
 #include <random>
@@ -14,17 +12,6 @@
 #define NUMBER_OF_SAMPLES 1000
 std::unique_ptr<RoboticArm> RoboArm;
 
-#ifdef RT_PRIORITY
-void SetProcessPriority(const int &number)
-{
-    /* https://rt.wiki.kernel.org/index.php/HOWTO:_Build_an_RT-application */
-    struct sched_param sp = { .sched_priority = number };
-    if( sched_setscheduler(0, RT_POLICY, &sp) != 0 ) {
-        logger << "W: Failed to increase process priority!\n" << std::endl;
-    }
-}
-#endif
-
 void Shutdown(int signum)
 {
     logger << "I: Caught signal " << signum << std::endl;
@@ -39,12 +26,6 @@ int main(void)
 {
     Point t_coordinates, h_coordinates;
 
-    mlockall(MCL_CURRENT | MCL_FUTURE);
-    
-#ifdef RT_PRIORITY
-    SetProcessPriority(RT_PRIORITY);
-#endif
-
     /* Please check RoboticArtm_Config.h for number of joints*/
     RoboArm = std::unique_ptr<RoboticArm>(new RoboticArm());
     
@@ -61,7 +42,7 @@ int main(void)
     for(auto s = 0; s < NUMBER_OF_SAMPLES; s++) {
 
         /* Fill our N joints angles with random data */
-        std::vector<double> theta_random;
+        JointVector theta_random;
 
         /* Random value between [0, 2pi] */
         std::mt19937 rng(std::random_device{}());
@@ -70,7 +51,7 @@ int main(void)
         for(auto id = 0; id < config::joints_nr; id++) {
             const double random_theta = unif(rng);
             /* Limitting to 1° for faster metrics and less inertia*/
-            theta_random.push_back(random_theta / 360.0);
+            theta_random[id] = random_theta / 360.0;
         }
 
         /* Use Our Robot's FK to obtain a valid "random" position */
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include "../toolbox.h"
+#include "../RoboticArm_Config.h"
+#include "../Linux-Quadrature-Encoder/QuadratureEncoder.h"
+
+/*
+ * Throughput of the quadrature encoder edge path, the same decode the GPIO
+ * callbacks run on every edge, with the channel threads pinned to separate
+ * cores and a control thread reading snapshots on a third one. Run it with
+ * the motors idle, the encoders of the first two joints are used.
+ */
+
+/* Global command line knobs */
+double cl_option_time = 2;
+
+/* Results of one writer or reader thread */
+struct ThreadResult
+{
+    unsigned long long operations;
+};
+
+/* An encoder fed by the writer threads, through the Gray code steps of a
+ * shaft turning one way so every edge is a legal transition. The steps go
+ * on from one scenario to the next, as does the state of the encoder */
+struct EncoderFeed
+{
+    QuadratureEncoder *encoder;
+    int segments;
+    unsigned writers;
+    unsigned long long first_step;
+    std::atomic<unsigned long long> steps;
+
+    EncoderFeed(QuadratureEncoder *e, const int &s) : encoder(e), segments(s), writers(0), first_step(0), steps(0) {}
+};
+
+
+void PrintUsage()
+{
+    const std::string usage                                   \
+("                                                          \n\
+Usage: linux-robotic-arm-encoder-benchmark.app -t 2         \n\
+Measures the quadrature encoder edge decoding throughput.   \n\
+                                                            \n\
+    -t,--time=     Seconds per scenario (default 2)         \n\
+    -h,--help      Prints the usage and exit (this screen)  \n\
+                                                            \n\
+                                                            \n\
+Example:                                                    \n\
+linux-robotic-arm-encoder-benchmark.app -t 5                \n\
+");
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void ProcessCLI(int argc, char *argv[])
+{
+    int c, option_index = 0;
+
+    struct option long_options[] = {
+        { "time"    , required_argument , NULL, 't'},
+        { "help"    , no_argument       , NULL, 'h'},
+        { 0         , 0                 , NULL,  0 }
+    };
+
+    while ((c = getopt_long(argc, argv, "t:h", long_options, &option_index)) != -1)
+        switch(c) {
+
+            case 't':
+                cl_option_time = atof(optarg);
+                if (cl_option_time <= 0) PrintUsage();
+                break;
+
+            case 'h':
+            case '?':
+            default:
+                PrintUsage();
+
+        }
+}
+
+void PinToCPU(const int &cpu)
+{
+    /* Not enough cores, the scenario still runs but the threads may share one */
+    if (cpu >= (int)std::thread::hardware_concurrency()) return;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        logger << "W: Failed to pin a benchmark thread to CPU " << cpu << std::endl;
+    }
+}
+
+void ChannelWriter(EncoderFeed *feed, const int channel, const int cpu,
+                   const std::atomic<bool> *stop, ThreadResult *result)
+{
+    /* Channel A moves on the even steps and channel B on the odd ones, one
+     * edge per call like a GPIO interrupt. A lone writer takes every step,
+     * two of them take turns as the edges of a real encoder do */
+    static const unsigned char gray[4] = { 0x0, 0x1, 0x3, 0x2 };
+    unsigned long long edges = 0;
+
+    PinToCPU(cpu);
+
+    while (!*stop) {
+        const unsigned long long step = feed->steps.load(std::memory_order_acquire);
+        if (feed->writers > 1 && (int)(step & 1) != channel) {
+            sched_yield();
+            continue;
+        }
+
+        feed->encoder->DecodeSamples(&gray[(step + 1) & 3], 1, std::chrono::steady_clock::now());
+        feed->steps.store(step + 1, std::memory_order_release);
+        edges++;
+    }
+
+    result->operations = edges;
+}
+
+void SnapshotReader(std::vector<QuadratureEncoder *> encoders, const int cpu,
+                    const std::atomic<bool> *stop, ThreadResult *result)
+{
+    unsigned long long reads = 0;
+    volatile double sink = 0;
+
+    PinToCPU(cpu);
+
+    while (!*stop) {
+        for(auto encoder : encoders) sink = sink + encoder->GetSnapshot().angle;
+        reads++;
+    }
+
+    result->operations = reads;
+}
+
+void RunScenario(const std::string &name,
+                 const std::vector<EncoderFeed *> &writers,
+                 const std::vector<QuadratureEncoder *> &readers)
+{
+    std::atomic<bool> stop(false);
+    std::vector<ThreadResult> results(writers.size() + 1);
+    std::vector<std::thread> threads;
+
+    for(auto feed : writers) {
+        feed->writers = 0;
+        feed->first_step = feed->steps;
+        feed->encoder->SetZero();
+    }
+
+    /* Writer i takes the next free channel of its encoder, every feed knows
+     * how many writers it has before the first one starts */
+    std::vector<int> channels(writers.size());
+    for(size_t i = 0; i < writers.size(); i++) channels[i] = (int)writers[i]->writers++;
+
+    /* Writer i runs from CPU i, the reader sits right after them */
+    for(size_t i = 0; i < writers.size(); i++) {
+        threads.push_back(std::thread(ChannelWriter, writers[i], channels[i], (int)i, &stop, &results[i]));
+    }
+    if (!readers.empty()) {
+        threads.push_back(std::thread(SnapshotReader, readers, (int)writers.size(), &stop, &results.back()));
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(cl_option_time));
+    stop = true;
+    for(auto &thread : threads) thread.join();
+
+    unsigned long long edges = 0;
+    for(size_t i = 0; i < writers.size(); i++) edges += results[i].operations;
+
+    logger << "I: " << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(2)
+           << std::setw(8) << edges / cl_option_time / 1E06 << " M edges/s";
+    if (!readers.empty()) {
+        logger << std::setw(10) << results.back().operations / cl_option_time / 1E06 << " M snapshots/s";
+    }
+    logger << std::endl;
+
+    /* Every edge fed has to show up in the count, or the decode dropped some */
+    for(size_t i = 0; i < writers.size(); i++) {
+        const EncoderFeed *feed = writers[i];
+        if (std::find(writers.begin(), writers.begin() + i, feed) != writers.begin() + i) continue;
+
+        const unsigned long long fed = feed->steps - feed->first_step;
+        const long long counted = std::llabs(std::llround(feed->encoder->GetAngle() * feed->segments / 360.0));
+        if (counted != (long long)fed) {
+            logger << "W: " << name << " fed " << fed << " edges but the encoder counted "
+                   << counted << std::endl;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ProcessCLI(argc, argv);
+
+    /* Two encoders allocated back to back, like the joints of the arm */
+    std::unique_ptr<QuadratureEncoder> first(new QuadratureEncoder(config::quad_encoder_pins[0][0],
+                                                                   config::quad_encoder_pins[0][1],
+                                                                   config::quad_encoder_rate));
+    std::unique_ptr<QuadratureEncoder> second(new QuadratureEncoder(config::quad_encoder_pins[1][0],
+                                                                    config::quad_encoder_pins[1][1],
+                                                                    config::quad_encoder_rate));
+    first->SetParameters(config::quad_encoder_segments[0]);
+    second->SetParameters(config::quad_encoder_segments[1]);
+
+    logger << "I: Running each scenario for " << cl_option_time << "s on "
+           << std::thread::hardware_concurrency() << " CPUs" << std::endl;
+
+    EncoderFeed a(first.get(), config::quad_encoder_segments[0]);
+    EncoderFeed b(second.get(), config::quad_encoder_segments[1]);
+
+    /* Baseline, a single edge thread and nobody reading */
+    RunScenario("1 thread, 1 encoder", { &a }, {});
+    /* Both channels of one encoder on separate cores, taking turns on the decode state */
+    RunScenario("2 threads, 1 encoder", { &a, &a }, { a.encoder });
+    /* One edge thread per encoder on separate cores, nothing is shared between them */
+    RunScenario("2 threads, 2 encoders", { &a, &b }, { a.encoder, b.encoder });
+
+    return EXIT_SUCCESS;
+}
@@ -2,8 +2,6 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sched.h>
-#include <sys/mman.h>
 #include <boost/timer/timer.hpp>
 #include <iomanip>
 #include <random>
@@ -14,17 +12,6 @@
 
 std::unique_ptr<RoboticArm> RoboArm;
 
-#ifdef RT_PRIORITY
-void SetProcessPriority(const int &number)
-{
-    /* https://rt.wiki.kernel.org/index.php/HOWTO:_Build_an_RT-application */
-    struct sched_param sp = { .sched_priority = number };
-    if( sched_setscheduler(0, RT_POLICY, &sp) != 0 ) {
-        logger << "W: Failed to increase process priority!\n" << std::endl;
-    }
-}
-#endif
-
 void Shutdown(int signum)
 {
     logger << "I: Caught signal " << signum << std::endl;
@@ -82,16 +69,10 @@ int main(void)
     std::unique_ptr<RoboticArm> RoboArm;
     Point coordinates;
 
-    mlockall(MCL_CURRENT | MCL_FUTURE);
-
     InitializeScreen();
     /* Redirect all of std::cout to a curses complaint window */
     toolbox::ncurses_stream redirector_cout(std::cout);
     
-#ifdef RT_PRIORITY
-    SetProcessPriority(RT_PRIORITY);
-#endif
-
     /* Please check RoboticArtm_Config.h for number of joints*/
     RoboArm = std::unique_ptr<RoboticArm>(new RoboticArm());
     
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <algorithm>
+#include "../toolbox.h"
+#include "../Kinematics.h"
+#include "../RoboticArm.h"
+#include "../TrajectoryFile.h"
+#include "../RoboticArm_Config.h"
+
+/*
+ * Throughput of the kinematics of the configured chain over a recorded
+ * trajectory, repeated until it reaches the requested number of points.
+ * Every point goes through forward and inverse kinematics one at a time,
+ * and through the batch versions built as scalar code and as SIMD lanes.
+ * No joint is created, so it runs without the motors and encoders.
+ */
+
+typedef kinematics::Chain<config::joints_nr> Chain;
+
+/* Global command line knobs */
+std::string cl_option_filename("Examples/trajectory-example.rec");
+size_t cl_option_points = 2000000;
+
+
+void PrintUsage()
+{
+    const std::string usage                                   \
+("                                                          \n\
+Usage: linux-robotic-arm-kinematics-benchmark.app -n 2000000\n\
+Measures the kinematics throughput over a trajectory.       \n\
+                                                            \n\
+    -f,--file=     Trajectory file, text or binary          \n\
+                   (default Examples/trajectory-example.rec)\n\
+    -n,--points=   Points to solve (default 2000000)        \n\
+    -h,--help      Prints the usage and exit (this screen)  \n\
+                                                            \n\
+                                                            \n\
+Example:                                                    \n\
+linux-robotic-arm-kinematics-benchmark.app -f trajectory.rec -n 10000000\n\
+");
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void ProcessCLI(int argc, char *argv[])
+{
+    int c, option_index = 0;
+
+    struct option long_options[] = {
+        { "file"    , required_argument , NULL, 'f'},
+        { "points"  , required_argument , NULL, 'n'},
+        { "help"    , no_argument       , NULL, 'h'},
+        { 0         , 0                 , NULL,  0 }
+    };
+
+    while ((c = getopt_long(argc, argv, "f:n:h", long_options, &option_index)) != -1)
+        switch(c) {
+
+            case 'f':
+                cl_option_filename.assign(optarg);
+                break;
+
+            case 'n':
+                cl_option_points = atol(optarg);
+                if (cl_option_points == 0) PrintUsage();
+                break;
+
+            case 'h':
+            case '?':
+            default:
+                PrintUsage();
+
+        }
+}
+
+/* Structure of arrays buffers for every point of the workload */
+struct Points
+{
+    std::vector<double> x, y, z;
+    std::vector<double> theta[config::joints_nr];
+
+    explicit Points(const size_t &count) : x(count), y(count), z(count)
+    {
+        for(auto &angles : theta) angles.assign(count, 0);
+    }
+
+    const double *const *Angles(void)
+    {
+        for(auto id = 0; id < config::joints_nr; id++) _columns[id] = theta[id].data();
+        return _columns;
+    }
+
+    double *const *MutableAngles(void)
+    {
+        for(auto id = 0; id < config::joints_nr; id++) _columns[id] = theta[id].data();
+        return _columns;
+    }
+
+    private:
+        double *_columns[config::joints_nr];
+};
+
+bool LoadPath(std::vector<Point> &path)
+{
+    if (TrajectoryReader::IsBinary(cl_option_filename)) {
+        TrajectoryReader file(cl_option_filename);
+        for(size_t n = 0; n < file.GetSize(); n++) {
+            const TrajectoryRecord &record = file.GetRecord(n);
+            Point p;
+            p.x = record.x;
+            p.y = record.y;
+            p.z = record.z;
+            path.push_back(p);
+        }
+    } else {
+        std::vector<std::pair<Point, double>> trajectory;
+        if (!ParseTrajectoryText(cl_option_filename, trajectory)) return false;
+        for(auto &point_and_time : trajectory) path.push_back(point_and_time.first);
+    }
+
+    return !path.empty();
+}
+
+void Measure(const std::string &name, const std::function<void(void)> &work)
+{
+    const auto start = std::chrono::steady_clock::now();
+    work();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    logger << "I: " << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(2)
+           << std::setw(10) << cl_option_points / seconds / 1E06 << " M points/s"
+           << std::setw(10) << seconds * 1E09 / cl_option_points << " ns/point" << std::endl;
+}
+
+double MaxDistance(const Points &a, const Points &b)
+{
+    double worst = 0;
+    for(size_t n = 0; n < a.x.size(); n++) {
+        worst = std::max(worst, std::sqrt((a.x[n] - b.x[n]) * (a.x[n] - b.x[n]) +
+                                          (a.y[n] - b.y[n]) * (a.y[n] - b.y[n]) +
+                                          (a.z[n] - b.z[n]) * (a.z[n] - b.z[n])));
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[])
+{
+    ProcessCLI(argc, argv);
+
+    std::vector<Point> path;
+    if (!LoadPath(path)) {
+        logger << "E: No points found in \"" << cl_option_filename << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /* The recorded path over and over until we have all of the points */
+    Points targets(cl_option_points);
+    for(size_t n = 0; n < cl_option_points; n++) {
+        targets.x[n] = path[n % path.size()].x;
+        targets.y[n] = path[n % path.size()].y;
+        targets.z[n] = path[n % path.size()].z;
+    }
+
+    const Chain chain(config::dh_parameters);
+    Points single(cl_option_points), scalar(cl_option_points), lanes(cl_option_points);
+    size_t unsolved = 0;
+
+    logger << "I: " << cl_option_points << " points from " << path.size() << " recorded ones, "
+           << config::joints_nr << " joints, " << (size_t)kinematics::simd::width<kinematics::simd::lanes>::value
+           << " points per SIMD operation" << std::endl;
+
+    /* Inverse kinematics the way the arm solves a single point, unsolved
+     * points keep the previous solution like they do in the batches */
+    const bool analytic = chain.Analytic();
+    Measure("IK one point at a time", [&]() {
+        Chain::Angles theta = {}, solved = {};
+        for(size_t n = 0; n < cl_option_points; n++) {
+            const Chain::Position target = {{{ targets.x[n] }, { targets.y[n] }, { targets.z[n] }}};
+            const double residual = analytic ? chain.InverseAnalytic(target, theta).residual :
+                                    chain.Inverse(target, theta, config::ik_max_iterations,
+                                                  config::ik_damping, config::ik_tolerance).residual;
+            if (residual <= tolerance) solved = theta;
+            else theta = solved;
+            for(auto id = 0; id < config::joints_nr; id++) single.theta[id][n] = theta[id];
+        }
+    });
+    Measure("IK batch, scalar", [&]() {
+        chain.InverseBatch<double>(targets.x.data(), targets.y.data(), targets.z.data(), cl_option_points,
+                                   scalar.MutableAngles(), config::ik_max_iterations,
+                                   config::ik_damping, config::ik_tolerance, tolerance);
+    });
+    Measure("IK batch, SIMD", [&]() {
+        unsolved = chain.InverseBatch(targets.x.data(), targets.y.data(), targets.z.data(), cl_option_points,
+                                      lanes.MutableAngles(), config::ik_max_iterations,
+                                      config::ik_damping, config::ik_tolerance, tolerance);
+    });
+
+    /* Forward kinematics of the solved angles, back to where we started */
+    Measure("FK one point at a time", [&]() {
+        Chain::Angles theta;
+        for(size_t n = 0; n < cl_option_points; n++) {
+            for(auto id = 0; id < config::joints_nr; id++) theta[id] = lanes.theta[id][n];
+            const kinematics::Transform pose = chain.Forward(theta);
+            single.x[n] = pose(0, 3);
+            single.y[n] = pose(1, 3);
+            single.z[n] = pose(2, 3);
+        }
+    });
+    Measure("FK batch, scalar", [&]() {
+        chain.ForwardBatch<double>(lanes.Angles(), cl_option_points,
+                                   scalar.x.data(), scalar.y.data(), scalar.z.data());
+    });
+    Measure("FK batch, SIMD", [&]() {
+        chain.ForwardBatch(lanes.Angles(), cl_option_points,
+                           lanes.x.data(), lanes.y.data(), lanes.z.data());
+    });
+
+    logger << "I: " << unsolved << " points out of reach" << std::endl;
+    logger << "I: Largest FK(IK(p)) distance to p " << std::scientific << std::setprecision(2)
+           << MaxDistance(targets, lanes) << " m" << std::endl;
+    logger << "I: Largest SIMD to one at a time FK difference " << MaxDistance(single, lanes) << " m" << std::endl;
+
+    return EXIT_SUCCESS;
+}
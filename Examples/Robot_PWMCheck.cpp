@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <memory>
+#include <cmath>
+#include "../toolbox.h"
+#include "../Linux-DC-Motor/Motor.h"
+
+/*
+ * Drives a motor through the memory mapped PWM registers backed by a
+ * regular file, and checks the register words it leaves behind for the
+ * duty cycle, enable and direction changes. The file plays the hardware:
+ * nothing latches an update until this program clears its bit 30.
+ */
+
+/* Global command line knobs */
+std::string cl_option_filename;
+
+/* Control register fields, as documented for the LPSS PWM block */
+static const uint32_t enable = 1U << 31;
+static const uint32_t sw_update = 1U << 30;
+
+/* Checks that failed so far */
+int failures = 0;
+
+
+void PrintUsage()
+{
+    const std::string usage                                   \
+("                                                          \n\
+Usage: linux-robotic-arm-pwm-check.app                      \n\
+Checks the PWM register words written for a motor.          \n\
+                                                            \n\
+    -f,--file=     File standing in for the registers       \n\
+                   (default a temporary one, removed after) \n\
+    -h,--help      Prints the usage and exit (this screen)  \n\
+                                                            \n\
+                                                            \n\
+Example:                                                    \n\
+linux-robotic-arm-pwm-check.app -f /tmp/pwm-registers       \n\
+");
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void ProcessCLI(int argc, char *argv[])
+{
+    int c, option_index = 0;
+
+    struct option long_options[] = {
+        { "file"    , required_argument , NULL, 'f'},
+        { "help"    , no_argument       , NULL, 'h'},
+        { 0         , 0                 , NULL,  0 }
+    };
+
+    while ((c = getopt_long(argc, argv, "f:h", long_options, &option_index)) != -1)
+        switch(c) {
+
+            case 'f':
+                cl_option_filename.assign(optarg);
+                break;
+
+            case 'h':
+            case '?':
+            default:
+                PrintUsage();
+
+        }
+}
+
+/* Register word for a duty cycle fraction at the motor PWM frequency,
+ * worked out from the datasheet fields rather than from PWMRegisters */
+uint32_t Word(const double &duty, const uint32_t &flags)
+{
+    const uint32_t base_unit = std::llround(BASE_PWM_FREQUENCY_HZ * 4194304.0 / 19.2E6);
+    const uint32_t on_time = 255 * duty;
+    return flags | (base_unit << 8) | (255 - on_time);
+}
+
+/* What the hardware does on its next period, the pending updates latch */
+void Latch(const int &fd)
+{
+    for(off_t channel = 0; channel < 2; channel++) {
+        uint32_t control;
+        if (pread(fd, &control, sizeof(control), channel * 0x400) != sizeof(control)) return;
+        control &= ~sw_update;
+        if (pwrite(fd, &control, sizeof(control), channel * 0x400) != sizeof(control)) return;
+    }
+}
+
+void Expect(const std::string &step, PWMRegisters &registers, const uint32_t &a, const uint32_t &b)
+{
+    const uint32_t read_a = registers.GetControl(0), read_b = registers.GetControl(1);
+    const bool ok = (read_a == a) && (read_b == b);
+
+    logger << (ok ? "I: " : "E: ") << std::left << std::setw(40) << step << std::right << std::hex
+           << " A=0x" << std::setw(8) << std::setfill('0') << read_a
+           << " B=0x" << std::setw(8) << read_b << std::setfill(' ') << std::dec;
+    if (!ok) {
+        logger << " expected A=0x" << std::hex << std::setw(8) << std::setfill('0') << a
+               << " B=0x" << std::setw(8) << b << std::setfill(' ') << std::dec;
+        failures++;
+    }
+    logger << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    ProcessCLI(argc, argv);
+
+    /* An empty file, PWMRegisters grows it to fit the block */
+    const bool temporary = cl_option_filename.empty();
+    char name[] = "/tmp/pwm-registers-XXXXXX";
+    const int created = temporary ? mkstemp(name) :
+                        open(cl_option_filename.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (created < 0) {
+        logger << "E: Unable to create a register file" << std::endl;
+        return EXIT_FAILURE;
+    }
+    close(created);
+    if (temporary) cl_option_filename.assign(name);
+
+    {
+        auto registers = std::make_shared<PWMRegisters>(cl_option_filename, 0);
+        const int fd = open(cl_option_filename.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            logger << "E: Unable to open \"" << cl_option_filename << "\"" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::unique_ptr<Motor> motor(new Motor(0, 1, registers));
+
+        /* Only the period went out, the duty and enable wait for a latch */
+        Expect("Created, period pending a latch", *registers,
+               Word(0, sw_update), Word(0, sw_update));
+
+        Latch(fd);
+        motor->SetSpeed(25);
+        Expect("Enabled, 25% waits for the next latch", *registers,
+               Word(0, enable | sw_update), Word(0, enable | sw_update));
+
+        Latch(fd);
+        motor->SetSpeed(25);
+        Expect("25% duty on channel A", *registers,
+               Word(0.25, enable | sw_update), Word(0, enable));
+
+        Latch(fd);
+        motor->SetDirection(Motor::Direction::CCW);
+        Expect("Direction changed to channel B", *registers,
+               Word(0, enable | sw_update), Word(0.25, enable | sw_update));
+
+        motor->Disabled();
+        Expect("Disabled before the latch", *registers,
+               Word(0, sw_update), Word(0.25, sw_update));
+
+        motor.reset();
+        close(fd);
+    }
+
+    if (temporary) unlink(cl_option_filename.c_str());
+
+    logger << (failures ? "E: " : "I: ") << failures << " register checks failed" << std::endl;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
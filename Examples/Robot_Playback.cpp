@@ -2,9 +2,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sched.h>
 #include <getopt.h>
-#include <sys/mman.h>
 #include <boost/timer/timer.hpp>
 #include <iomanip>
 #include <iostream>
@@ -14,6 +12,8 @@
 #include <chrono>
 #include "../toolbox.h"
 #include "../RoboticArm.h"
+#include "../Trajectory.h"
+#include "../TrajectoryFile.h"
 #include "../RoboticArm_Config.h"
 
 
@@ -23,17 +23,6 @@ std::unique_ptr<RoboticArm> RoboArm;
 std::string cl_option_filename;
 uint64_t cl_option_loop = 1;
 
-#ifdef RT_PRIORITY
-void SetProcessPriority(const int &number)
-{
-    /* https://rt.wiki.kernel.org/index.php/HOWTO:_Build_an_RT-application */
-    struct sched_param sp = { .sched_priority = number };
-    if( sched_setscheduler(0, RT_POLICY, &sp) != 0 ) {
-        logger << "W: Failed to increase process priority!\n" << std::endl;
-    }
-}
-#endif
-
 void Shutdown(int signum)
 {
     logger << "I: Caught signal " << signum << std::endl;
@@ -96,63 +85,11 @@ void ProcessCLI(int argc, char *argv[])
         }
 }
 
-void ParseTrajectoryFile(const std::string &file, std::vector<std::pair<Point, double>> &trajectory)
-{
-    logger << "I: Loading trajectory file: \"" << file << "\"" << std::endl;
-
-    std::string line;
-    std::ifstream infile(file);
-
-    if(infile.is_open()) {
-
-        while(infile.good() ) {
-
-            if (std::getline(infile, line)) {
-
-                /* Store the line being parsed as string for manipulation */
-                char *token = std::strtok((char *)line.c_str(), " ");
-                std::vector<std::string> split_line;
-
-                /* Splitting elements and saving them into a vector */
-                while(token != NULL) {
-                    split_line.push_back(token);
-                    token = std::strtok(NULL, " ");
-                }
-
-                /* First 3 fields form the coordinates */
-                Point p;
-                p.x = std::stod(split_line[0]);
-                p.y = std::stod(split_line[1]);
-                p.z = std::stod(split_line[2]);
-
-                /* Last field contains timestamp in seconds */
-                double t = std::stod(split_line[3]);
-
-                trajectory.push_back(std::make_pair(p, t));
-
-            }
-
-        }
-        
-        infile.close();
-        
-    } else {
-        logger << "E: Failed to load the trajectory file" << std::endl;
-        return;
-    }
-
-    logger << "I: Loaded " << trajectory.size() << " points from the trajectory file" << std::endl;
-}
-
 int main(int argc, char *argv[])
 {
-    std::vector<std::pair<Point, double>> trajectory;
-
     /* Process the trajectory filename and arguments */
     ProcessCLI(argc, argv);
 
-    mlockall(MCL_CURRENT | MCL_FUTURE);
-
     /* Please check RoboticArtm_Config.h for number of joints*/
     RoboArm = std::unique_ptr<RoboticArm>(new RoboticArm());
     
@@ -161,25 +98,26 @@ int main(int argc, char *argv[])
 
     RoboArm->Init();
 
-    /* Preload the input file, and start loading it in memory */
-    ParseTrajectoryFile(cl_option_filename, trajectory);
+    /* Preload the input file, solving the whole path in joint space once */
+    logger << "I: Loading trajectory file: \"" << cl_option_filename << "\"" << std::endl;
+    Trajectory path;
 
-    while(cl_option_loop--) {
-
-        /* Base off our current time as our beginning */
-        double delta_time = 0;
-
-        /* Start feeding the trajectory data into our robot for play back */
-        for(auto &point_and_time : trajectory) {
-
-                Point p = point_and_time.first;
-                double t = point_and_time.second - delta_time;
-                delta_time = point_and_time.second;
+    if (TrajectoryReader::IsBinary(cl_option_filename)) {
+        /* Binary recordings are mapped in memory, no parsing involved */
+        TrajectoryReader file(cl_option_filename);
+        logger << "I: Loaded " << file.GetSize() << " points from the trajectory file" << std::endl;
+        path.Load(*RoboArm, file);
+    } else {
+        std::vector<std::pair<Point, double>> trajectory;
+        if (!ParseTrajectoryText(cl_option_filename, trajectory)) exit(EXIT_FAILURE);
+        logger << "I: Loaded " << trajectory.size() << " points from the trajectory file" << std::endl;
+        path.Load(*RoboArm, trajectory);
+    }
 
-                RoboArm->SetPosition(p);
-                usleep(t * 1E06);
+    while(cl_option_loop--) {
 
-        }
+        /* Smoothly interpolated references streamed at the control rate */
+        path.Play(*RoboArm);
 
     }
 
@@ -2,45 +2,41 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sched.h>
 #include <getopt.h>
-#include <sys/mman.h>
 #include <boost/timer/timer.hpp>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
 #include <cstring>
 #include <string>
+#include <atomic>
+#include <chrono>
 #include "../toolbox.h"
 #include "../RoboticArm.h"
+#include "../TrajectoryFile.h"
 #include "../RoboticArm_Config.h"
 
 #define RECORD_RATE_HZ 100
 std::unique_ptr<RoboticArm> RoboArm;
-std::unique_ptr<std::ofstream> outfile;
+std::unique_ptr<AsyncTrajectoryWriter> outfile;
+
+/* Samples that could not be taken on their release time */
+std::atomic<unsigned long long> late_samples(0);
 
 /* Global command line knobs */
 std::string cl_option_filename;
-
-#ifdef RT_PRIORITY
-void SetProcessPriority(const int &number)
-{
-    /* https://rt.wiki.kernel.org/index.php/HOWTO:_Build_an_RT-application */
-    struct sched_param sp = { .sched_priority = number };
-    if( sched_setscheduler(0, RT_POLICY, &sp) != 0 ) {
-        logger << "W: Failed to increase process priority!\n" << std::endl;
-    }
-}
-#endif
+unsigned cl_option_rate = RECORD_RATE_HZ;
 
 void Shutdown(int signum)
 {
     logger << "I: Caught signal " << signum << std::endl;
 
-    /* Calling the destructor explicitly */
+    /* Calling the destructor explicitly, the writer drains before closing */
     RoboArm.reset();
     outfile.reset();
 
+    logger << "I: " << late_samples << " samples were taken late" << std::endl;
+
     std::exit(signum);
 }
 
@@ -48,10 +44,11 @@ void PrintUsage()
 {
     const std::string usage                                   \
 ("                                                          \n\
-Usage: linux-robotic-arm-recorder.app -f FILE               \n\
+Usage: linux-robotic-arm-recorder.app -f FILE -r 100       \n\
 Used to record the trajectory of a robotic arm.             \n\
                                                             \n\
-    -f,--file=     Trajectory file to playback              \n\
+    -f,--file=     Trajectory file to record (binary)       \n\
+    -r,--rate=     Sampling rate in Hz (default 100)        \n\
     -h,--help      Prints the usage and exit (this screen)  \n\
                                                             \n\
                                                             \n\
@@ -68,6 +65,7 @@ void ProcessCLI(int argc, char *argv[])
 
     struct option long_options[] = {
         { "file"    , required_argument , NULL, 'f'},
+        { "rate"    , required_argument , NULL, 'r'},
         { "help"    , no_argument       , NULL, 'h'},
         { 0         , 0                 , NULL,  0 }
     };
@@ -75,13 +73,18 @@ void ProcessCLI(int argc, char *argv[])
     if (argc < 2)
         PrintUsage();
 
-    while ((c = getopt_long(argc, argv, "f:h", long_options, &option_index)) != -1)
+    while ((c = getopt_long(argc, argv, "f:r:h", long_options, &option_index)) != -1)
         switch(c) {
 
             case 'f':
                 cl_option_filename.assign(optarg);
                 break;
 
+            case 'r':
+                cl_option_rate = (unsigned)atol(optarg);
+                if (cl_option_rate == 0) PrintUsage();
+                break;
+
             case 'h':
             case '?':
             default:
@@ -93,26 +96,20 @@ void ProcessCLI(int argc, char *argv[])
 int main(int argc, char *argv[])
 {
     Point coordinates;
-    double timestamp = 0.0;
-
-    /* Used for single line messages */
-    char buffer[80];
+    JointVector theta;
 
     /* Process the trajectory filename and arguments */
     ProcessCLI(argc, argv);
 
-    mlockall(MCL_CURRENT | MCL_FUTURE);
-
     /* Please check RoboticArtm_Config.h for number of joints*/
     RoboArm = std::unique_ptr<RoboticArm>(new RoboticArm());
     
-    /* File that we will be writing to */
-    outfile = std::unique_ptr<std::ofstream>(new std::ofstream(cl_option_filename,
-                                                               std::ios::binary |
-                                                               std::ios::trunc));
-
-    if(outfile == NULL) {
-        logger << "E: Failed to write the trajectory file" << std::endl;
+    /* File that we will be writing to from a background thread */
+    try {
+        outfile = std::unique_ptr<AsyncTrajectoryWriter>(new AsyncTrajectoryWriter(cl_option_filename,
+                                                                                   cl_option_rate));
+    } catch(const std::runtime_error &e) {
+        logger << "E: Failed to write the trajectory file: " << e.what() << std::endl;
         exit(-73);
     }
 
@@ -128,20 +125,22 @@ int main(int argc, char *argv[])
     logger << "I: You can now begin to move the robot" << std::endl;
     logger << "I: Press <Ctrl-C> to stop recording" << std::endl;
 
+    /* Samples are released on absolute deadlines, so there is no drift */
+    toolbox::periodic_timer period(1E09 / cl_option_rate);
+    const auto start_time = std::chrono::steady_clock::now();
+
     for(;;) {
 
         /* Update the position and time stamp before we write it down */
-        RoboArm->GetPosition(coordinates);
-        timestamp += (1 / (double)RECORD_RATE_HZ);
-
-        /* Format is x y z timestamp */
-        sprintf(buffer, "%2.8f %2.8f %2.8f %2.9f",
-                coordinates.x, coordinates.y, coordinates.z, timestamp);
+        RoboArm->GetAngles(theta);
+        RoboArm->ForwardKinematics(coordinates, theta);
+        const double timestamp = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start_time).count();
 
-        /* Write into the file */
-        *outfile << buffer << std::endl;
+        /* Handed over to the writer thread, never touches the file system */
+        outfile->Append(coordinates, timestamp, theta.data());
 
-        usleep((1 / (double)RECORD_RATE_HZ) * 1E06);
+        if (!period.wait()) late_samples++;
 
     }
 
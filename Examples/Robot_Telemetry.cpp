@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include "../toolbox.h"
+#include "../Telemetry.h"
+#include "../RoboticArm_Config.h"
+
+/*
+ * Tails the control loop telemetry of a running arm into a CSV or binary
+ * file. The segment is mapped read only and polled, so the control loops
+ * never wait for, nor share a written cache line with, this reader.
+ */
+
+/* Records copied per joint and system call free poll */
+#define READ_BATCH 256
+/* How long to wait for new records once every joint is caught up */
+#define POLL_PERIOD_MS 20
+
+/* Global command line knobs */
+std::string cl_option_name(config::telemetry_shm_name);
+std::string cl_option_output("telemetry.csv");
+bool cl_option_binary = false;
+bool cl_option_follow = false;
+int cl_option_joint = -1;
+
+volatile sig_atomic_t stop_requested = 0;
+
+
+void Shutdown(int)
+{
+    stop_requested = 1;
+}
+
+void PrintUsage()
+{
+    const std::string usage                                   \
+("                                                          \n\
+Usage: linux-robotic-arm-telemetry.app -o FILE -f           \n\
+Copies the control loop telemetry of a running arm.         \n\
+                                                            \n\
+    -o,--output=   File to write, - for the standard output \n\
+                   (default telemetry.csv)                  \n\
+    -b,--binary    Raw records after the segment header,    \n\
+                   instead of CSV                           \n\
+    -f,--follow    Keep on tailing new records until Ctrl-C \n\
+    -j,--joint=    Only the records of this joint           \n\
+    -s,--segment=  Shared memory segment name               \n\
+                   (default /robotic-arm-telemetry)         \n\
+    -h,--help      Prints the usage and exit (this screen)  \n\
+                                                            \n\
+                                                            \n\
+Example:                                                    \n\
+linux-robotic-arm-telemetry.app -f -j 0 -o - | head -n 1000 \n\
+");
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void ProcessCLI(int argc, char *argv[])
+{
+    int c, option_index = 0;
+
+    struct option long_options[] = {
+        { "output"  , required_argument , NULL, 'o'},
+        { "binary"  , no_argument       , NULL, 'b'},
+        { "follow"  , no_argument       , NULL, 'f'},
+        { "joint"   , required_argument , NULL, 'j'},
+        { "segment" , required_argument , NULL, 's'},
+        { "help"    , no_argument       , NULL, 'h'},
+        { 0         , 0                 , NULL,  0 }
+    };
+
+    while ((c = getopt_long(argc, argv, "o:bfj:s:h", long_options, &option_index)) != -1)
+        switch(c) {
+
+            case 'o':
+                cl_option_output.assign(optarg);
+                break;
+
+            case 'b':
+                cl_option_binary = true;
+                break;
+
+            case 'f':
+                cl_option_follow = true;
+                break;
+
+            case 'j':
+                cl_option_joint = atoi(optarg);
+                if (cl_option_joint < 0) PrintUsage();
+                break;
+
+            case 's':
+                cl_option_name.assign(optarg);
+                break;
+
+            case 'h':
+            case '?':
+            default:
+                PrintUsage();
+
+        }
+}
+
+void WriteRecords(FILE *out, const TelemetryRecord *records, const size_t &count)
+{
+    if (cl_option_binary) {
+        fwrite(records, sizeof(TelemetryRecord), count, out);
+        return;
+    }
+
+    for(size_t n = 0; n < count; n++) {
+        const TelemetryRecord &r = records[n];
+        fprintf(out, "%u,%llu,%llu,%.6f,%.6f,%.6f,%.4f,%u,%u\n",
+                r.joint, (unsigned long long)r.sequence, (unsigned long long)r.timestamp_ns,
+                r.reference, r.measured, r.error, r.effort, r.period_ns, r.compute_ns);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ProcessCLI(argc, argv);
+
+    const bool to_stdout = (cl_option_output == "-");
+    /* Our own messages would end up mixed with the records */
+    if (to_stdout) toolbox::set_log_level(toolbox::log_level::error);
+
+    std::unique_ptr<TelemetrySegment> segment;
+    try {
+        segment = std::unique_ptr<TelemetrySegment>(new TelemetrySegment(cl_option_name));
+    } catch(const std::runtime_error &e) {
+        logger << "E: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const TelemetryHeader &header = segment->GetHeader();
+    if (cl_option_joint >= (int)header.joints_nr) {
+        logger << "E: The arm only has " << header.joints_nr << " joints" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = to_stdout ? stdout : fopen(cl_option_output.c_str(), cl_option_binary ? "wb" : "w");
+    if (out == NULL) {
+        logger << "E: Unable to write \"" << cl_option_output << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (cl_option_binary) {
+        fwrite(&header, sizeof(header), 1, out);
+    } else {
+        fprintf(out, "joint,sequence,timestamp_ns,reference_deg,measured_deg,error_deg,"
+                     "effort_pct,period_ns,compute_ns\n");
+    }
+
+    signal(SIGINT, Shutdown);
+    signal(SIGTERM, Shutdown);
+
+    /* Everything still in the rings first, from the oldest record on */
+    std::vector<uint64_t> cursors(header.joints_nr, 0);
+    std::vector<TelemetryRecord> records(READ_BATCH);
+    unsigned long long written = 0, lost = 0;
+
+    logger << "I: Reading " << header.joints_nr << " joints from " << cl_option_name
+           << (cl_option_follow ? ", press <Ctrl-C> to stop" : "") << std::endl;
+
+    while (!stop_requested) {
+
+        size_t copied = 0;
+        for(unsigned joint = 0; joint < header.joints_nr; joint++) {
+            if ((cl_option_joint >= 0) && (joint != (unsigned)cl_option_joint)) continue;
+            const size_t count = segment->Read(joint, cursors[joint], records.data(), READ_BATCH, lost);
+            WriteRecords(out, records.data(), count);
+            copied += count;
+        }
+        written += copied;
+
+        /* Caught up with every joint */
+        if (copied == 0) {
+            if (!cl_option_follow) break;
+            fflush(out);
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_PERIOD_MS));
+        }
+
+    }
+
+    if (!to_stdout) fclose(out);
+    else fflush(out);
+
+    logger << "I: " << written << " records written to \"" << cl_option_output << "\"" << std::endl;
+    if (lost) {
+        logger << "W: " << lost << " records were overwritten before they could be read" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
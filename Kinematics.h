@@ -0,0 +1,551 @@
+#pragma once
+#include <cmath>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Kinematics of a serial chain of N revolute joints described by its
+ * Denavit-Hartenberg parameters (standard convention), each link frame is
+ * reached from the previous one through Rz(theta) Tz(d) Tx(a) Rx(alpha).
+ *
+ * Everything is sized at compile time on the number of joints, so the
+ * matrices live on the stack and a pose costs N 4x4 products, cheap
+ * enough to be evaluated from the control loops.
+ *
+ * Inverse kinematics of the end effector position is solved numerically
+ * with damped least squares, where the damping is adapted on every step
+ * the Levenberg-Marquardt way: it shrinks while the residual goes down and
+ * grows on rejected steps, which keeps it stable next to singularities.
+ * Starting from the current joint angles it converges in a few iterations.
+ *
+ * Whole trajectories go through the batch versions, which take structure
+ * of arrays buffers and evaluate several points per instruction. They are
+ * written once on top of GCC vector extensions, so the same code becomes
+ * AVX, SSE2 (or NEON) lanes, or plain scalar code on anything else, and
+ * carry their own branch free sin/cos/atan since libm has no vector calls.
+ *
+ * References:
+ * https://en.wikipedia.org/wiki/Denavit%E2%80%93Hartenberg_parameters
+ * https://www.math.ucsd.edu/~sbuss/ResearchWeb/ikmethods/iksurvey.pdf
+ * https://gcc.gnu.org/onlinedocs/gcc/Vector-Extensions.html
+ * http://www.netlib.org/cephes/
+ */
+
+namespace kinematics
+{
+    /* Several points per operation for the batch kernels */
+    namespace simd
+    {
+#if defined(__AVX__)
+        typedef double lanes __attribute__((vector_size(32)));
+#define KINEMATICS_SIMD
+#elif defined(__SSE2__) || defined(__ARM_NEON)
+        typedef double lanes __attribute__((vector_size(16)));
+#define KINEMATICS_SIMD
+#else
+        typedef double lanes;
+#endif
+
+        /* Points handled at once by a kernel built for V, double is the scalar one */
+        template<class V> struct width { static constexpr size_t value = sizeof(V) / sizeof(double); };
+
+        template<class V> inline V load(const double *p)
+        {
+            V v;
+            std::memcpy(&v, p, sizeof(V));
+            return v;
+        }
+
+        template<class V> inline void store(double *p, const V &v)
+        {
+            std::memcpy(p, &v, sizeof(V));
+        }
+
+        inline double sqrt(const double &v) { return std::sqrt(v); }
+
+#ifdef KINEMATICS_SIMD
+        inline lanes sqrt(const lanes &v)
+        {
+#if defined(__AVX__)
+            return _mm256_sqrt_pd(v);
+#elif defined(__SSE2__)
+            return _mm_sqrt_pd(v);
+#else
+            lanes r;
+            for(size_t l = 0; l < width<lanes>::value; l++) r[l] = std::sqrt(v[l]);
+            return r;
+#endif
+        }
+#endif
+
+        /* Nearest integer, exact for |v| < 2^51 */
+        template<class V> inline V round(const V &v)
+        {
+            const double magic = 6755399441055744.0;
+            return (v + magic) - magic;
+        }
+
+        template<class V> inline V abs(const V &v)
+        {
+            return (v < 0) ? -v : v;
+        }
+
+        /* Cephes sin/cos, reduced to [-pi/4, pi/4] with a three part pi/2 */
+        template<class V> inline void sincos(const V &x, V &s, V &c)
+        {
+            const V n = simd::round(x * M_2_PI);
+            const V r = ((x - n * 1.57079632673412561417e+00)
+                            - n * 6.07710050630396597660e-11)
+                            - n * 2.02226624879595063154e-21;
+            const V z = r * r;
+
+            const V ps = r + r * z * (((((1.58962301576546568060E-10 * z - 2.50507477628578072866E-8) * z
+                                          + 2.75573136213857245213E-6) * z - 1.98412698295895385996E-4) * z
+                                          + 8.33333333332211858878E-3) * z - 1.66666666666666307295E-1);
+            const V pc = 1.0 - 0.5 * z + z * z * (((((-1.13585365213876817300E-11 * z + 2.08757008419747316778E-9) * z
+                                                       - 2.75573141792967388112E-7) * z + 2.48015872888517045348E-5) * z
+                                                       - 1.38888888888730564116E-3) * z + 4.16666666666665929218E-2);
+
+            /* Quadrant of x, n modulo 4 */
+            const V q = n - 4.0 * simd::round(n * 0.25 - 0.375);
+
+            const auto odd = (q == 1.0) | (q == 3.0);
+            s = odd ? pc : ps;
+            c = odd ? ps : pc;
+            s = (q >= 2.0) ? -s : s;
+            c = ((q == 1.0) | (q == 2.0)) ? -c : c;
+        }
+
+        /* Cephes atan for x >= 0 */
+        template<class V> inline V atan(const V &x)
+        {
+            const double tan_3pi_8 = 2.41421356237309504880;
+            const double more_bits = 6.123233995736765886130E-17;
+
+            const auto big = (x > tan_3pi_8);
+            const auto mid = (x > 0.66);
+
+            const V y = big ? (V() + M_PI_2) : (mid ? (V() + M_PI_4) : V());
+            const V t = big ? (-1.0 / x) : (mid ? ((x - 1.0) / (x + 1.0)) : x);
+            const V extra = big ? (V() + more_bits) : (mid ? (V() + 0.5 * more_bits) : V());
+
+            const V z = t * t;
+            const V p = (((-8.750608600031904122785E-1 * z - 1.615753718733365076637E1) * z
+                          - 7.500855792314704667340E1) * z - 1.228866684490136173410E2) * z
+                          - 6.485021904942025371773E1;
+            const V q = ((((z + 2.485846490142306297962E1) * z + 1.650270098316988542046E2) * z
+                          + 4.328810604912902668951E2) * z + 4.853903996359136964868E2) * z
+                          + 1.945506571482613964425E2;
+
+            return y + (t * z * p / q + t) + extra;
+        }
+
+        template<class V> inline V atan2(const V &y, const V &x)
+        {
+            const V ay = simd::abs(y), ax = simd::abs(x);
+            /* Both zero gives 0, like the base of the arm */
+            const V a = simd::atan((ay == 0.0) ? V() : ay / ax);
+            const V r = (x < 0.0) ? (M_PI - a) : a;
+            return (y < 0.0) ? -r : r;
+        }
+    }
+
+    /* Dense row major matrix of a fixed size */
+    template<size_t Rows, size_t Cols> class Matrix
+    {
+        public:
+            double m[Rows][Cols];
+
+            static Matrix Zero(void)
+            {
+                Matrix z;
+                for(size_t r = 0; r < Rows; r++)
+                    for(size_t c = 0; c < Cols; c++) z.m[r][c] = 0;
+                return z;
+            }
+
+            static Matrix Identity(void)
+            {
+                Matrix i = Zero();
+                for(size_t d = 0; d < Rows && d < Cols; d++) i.m[d][d] = 1;
+                return i;
+            }
+
+            double &operator()(const size_t &r, const size_t &c) { return m[r][c]; }
+            const double &operator()(const size_t &r, const size_t &c) const { return m[r][c]; }
+
+            template<size_t K> Matrix<Rows, K> operator*(const Matrix<Cols, K> &b) const
+            {
+                Matrix<Rows, K> p;
+                for(size_t r = 0; r < Rows; r++) {
+                    for(size_t k = 0; k < K; k++) {
+                        double sum = 0;
+                        for(size_t c = 0; c < Cols; c++) sum += m[r][c] * b.m[c][k];
+                        p.m[r][k] = sum;
+                    }
+                }
+                return p;
+            }
+
+            Matrix<Cols, Rows> Transpose(void) const
+            {
+                Matrix<Cols, Rows> t;
+                for(size_t r = 0; r < Rows; r++)
+                    for(size_t c = 0; c < Cols; c++) t.m[c][r] = m[r][c];
+                return t;
+            }
+    };
+
+    /* Homogeneous transform of a link frame */
+    typedef Matrix<4, 4> Transform;
+
+    /* Solves A x = b in place for a symmetric positive definite A (Cholesky) */
+    template<size_t N> bool CholeskySolve(Matrix<N, N> a, Matrix<N, 1> &b)
+    {
+        /* Lower triangle of a becomes L, with A = L L^T */
+        for(size_t j = 0; j < N; j++) {
+            double diagonal = a.m[j][j];
+            for(size_t k = 0; k < j; k++) diagonal -= a.m[j][k] * a.m[j][k];
+            if (!(diagonal > 0)) return false;
+            a.m[j][j] = std::sqrt(diagonal);
+
+            for(size_t i = j + 1; i < N; i++) {
+                double sum = a.m[i][j];
+                for(size_t k = 0; k < j; k++) sum -= a.m[i][k] * a.m[j][k];
+                a.m[i][j] = sum / a.m[j][j];
+            }
+        }
+
+        /* Forward substitution with L, then backwards with L^T */
+        for(size_t i = 0; i < N; i++) {
+            double sum = b.m[i][0];
+            for(size_t k = 0; k < i; k++) sum -= a.m[i][k] * b.m[k][0];
+            b.m[i][0] = sum / a.m[i][i];
+        }
+        for(size_t i = N; i-- > 0;) {
+            double sum = b.m[i][0];
+            for(size_t k = i + 1; k < N; k++) sum -= a.m[k][i] * b.m[k][0];
+            b.m[i][0] = sum / a.m[i][i];
+        }
+
+        return true;
+    }
+
+    /* One row of the table, lengths in meters and angles in radians */
+    struct DHParameters
+    {
+        double a, alpha, d, theta_offset;
+    };
+
+    /* Transform from the frame of link i-1 to the one of link i */
+    inline Transform LinkTransform(const DHParameters &dh, const double &theta)
+    {
+        const double ct = std::cos(theta + dh.theta_offset), st = std::sin(theta + dh.theta_offset);
+        const double ca = std::cos(dh.alpha), sa = std::sin(dh.alpha);
+
+        Transform t = {{{ ct, -st * ca,  st * sa, dh.a * ct },
+                        { st,  ct * ca, -ct * sa, dh.a * st },
+                        {  0,       sa,       ca, dh.d      },
+                        {  0,        0,        0, 1         }}};
+        return t;
+    }
+
+
+    template<size_t N> class Chain
+    {
+        public:
+            typedef std::array<double, N> Angles;
+            typedef Matrix<3, 1> Position;
+
+            /* Outcome of an inverse kinematics solve, residual in meters */
+            struct Solution
+            {
+                int iterations;
+                double residual;
+            };
+
+            /* Rows given as { a, alpha, d, theta offset } */
+            explicit Chain(const double (&table)[N][4])
+            {
+                for(size_t i = 0; i < N; i++) {
+                    _dh[i] = { table[i][0], table[i][1], table[i][2], table[i][3] };
+                }
+            }
+
+            /* Pose of the end effector in the base frame */
+            Transform Forward(const Angles &theta) const
+            {
+                Transform pose = Transform::Identity();
+                for(size_t i = 0; i < N; i++) pose = pose * LinkTransform(_dh[i], theta[i]);
+                return pose;
+            }
+
+            /* Pose of every link frame, frames[i] is the one after joint i */
+            void Forward(const Angles &theta, std::array<Transform, N> &frames) const
+            {
+                Transform pose = Transform::Identity();
+                for(size_t i = 0; i < N; i++) {
+                    pose = pose * LinkTransform(_dh[i], theta[i]);
+                    frames[i] = pose;
+                }
+            }
+
+            /* Linear velocity Jacobian of the end effector, from the link frames */
+            Matrix<3, N> Jacobian(const std::array<Transform, N> &frames) const
+            {
+                Matrix<3, N> j;
+                const Transform &end = frames[N - 1];
+
+                for(size_t i = 0; i < N; i++) {
+                    /* Joint i turns about the z axis of the frame before it */
+                    const Transform origin = (i == 0) ? Transform::Identity() : frames[i - 1];
+                    const double z[3] = { origin.m[0][2], origin.m[1][2], origin.m[2][2] };
+                    const double r[3] = { end.m[0][3] - origin.m[0][3],
+                                          end.m[1][3] - origin.m[1][3],
+                                          end.m[2][3] - origin.m[2][3] };
+                    /* z x r */
+                    j.m[0][i] = z[1] * r[2] - z[2] * r[1];
+                    j.m[1][i] = z[2] * r[0] - z[0] * r[2];
+                    j.m[2][i] = z[0] * r[1] - z[1] * r[0];
+                }
+
+                return j;
+            }
+
+            /* Planar chains of 1 or 2 joints have a closed form solution */
+            bool Analytic(void) const { return (N <= 2) && Planar(); }
+
+            /* Closed form joint angles for the chains above, elbow angle positive.
+             * Points out of reach are solved on the workspace border, and the
+             * residual through forward kinematics tells how far off they are */
+            Solution InverseAnalytic(const Position &target, Angles &theta) const
+            {
+                const double x = target.m[0][0], y = target.m[1][0];
+
+                if (N == 1) {
+                    theta[0] = std::atan2(y, x);
+                } else {
+                    const double l0 = _dh[0].a, l1 = _dh[N - 1].a;
+                    /* Cosine of the elbow angle, clamped to [-1, 1] on the border */
+                    double d = (x * x + y * y - l0 * l0 - l1 * l1) / (2 * l0 * l1);
+                    d = std::max(-1.0, std::min(1.0, d));
+                    theta[N - 1] = std::atan2(std::sqrt(1 - d * d), d);
+                    theta[0] = std::atan2(y, x) - std::atan2(l1 * std::sin(theta[N - 1]),
+                                                             l0 + l1 * std::cos(theta[N - 1]));
+                }
+
+                return { 0, Norm(Error(target, Forward(theta))) };
+            }
+
+            /* Joint angles that bring the end effector to target, theta holds the
+             * starting guess and is left with the best solution that was found */
+            Solution Inverse(const Position &target, Angles &theta,
+                             const int &max_iterations,
+                             const double &damping,
+                             const double &tolerance) const
+            {
+                std::array<Transform, N> frames;
+                Forward(theta, frames);
+
+                Position error = Error(target, frames[N - 1]);
+                double residual = Norm(error);
+                double lambda = damping;
+                int iteration = 0;
+
+                for(; (iteration < max_iterations) && (residual > tolerance); iteration++) {
+
+                    const Matrix<3, N> j = Jacobian(frames);
+
+                    /* dtheta = J^T (J J^T + lambda^2 I)^-1 e */
+                    Matrix<3, 3> a = j * j.Transpose();
+                    for(size_t d = 0; d < 3; d++) a.m[d][d] += lambda * lambda;
+
+                    Position y = error;
+                    if (!CholeskySolve(a, y)) break;
+
+                    const Matrix<N, 1> step = j.Transpose() * y;
+
+                    Angles candidate = theta;
+                    for(size_t i = 0; i < N; i++) candidate[i] += step.m[i][0];
+
+                    std::array<Transform, N> candidate_frames;
+                    Forward(candidate, candidate_frames);
+                    const Position candidate_error = Error(target, candidate_frames[N - 1]);
+                    const double candidate_residual = Norm(candidate_error);
+
+                    if (candidate_residual < residual) {
+                        /* Closer to Gauss-Newton while it keeps working */
+                        theta = candidate;
+                        frames = candidate_frames;
+                        error = candidate_error;
+                        residual = candidate_residual;
+                        lambda = std::max(lambda / 2, damping * 1E-03);
+                    } else {
+                        /* Closer to gradient descent, with a shorter step */
+                        lambda = lambda * 4;
+                    }
+                }
+
+                return { iteration, residual };
+            }
+
+            const DHParameters &Link(const size_t &i) const { return _dh[i]; }
+
+            /* Planar chains (no twists, offsets or link heights) move on the xy plane */
+            bool Planar(void) const
+            {
+                for(size_t i = 0; i < N; i++) {
+                    if ((_dh[i].alpha != 0) || (_dh[i].d != 0) || (_dh[i].theta_offset != 0)) return false;
+                }
+                return true;
+            }
+
+            /* End effector positions of count points, theta[i] holds the angles
+             * of joint i, everything as structure of arrays */
+            template<class V = simd::lanes>
+            void ForwardBatch(const double *const *theta, const size_t &count,
+                              double *x, double *y, double *z) const
+            {
+                const size_t w = simd::width<V>::value;
+                double ca[N], sa[N];
+                for(size_t i = 0; i < N; i++) {
+                    ca[i] = std::cos(_dh[i].alpha);
+                    sa[i] = std::sin(_dh[i].alpha);
+                }
+
+                size_t n = 0;
+                for(; n + w <= count; n += w) {
+                    /* Rotation and translation of the pose, one lane per point */
+                    V r[3][3] = {{ V() + 1.0, V(), V() }, { V(), V() + 1.0, V() }, { V(), V(), V() + 1.0 }};
+                    V p[3] = { V(), V(), V() };
+
+                    for(size_t i = 0; i < N; i++) {
+                        V st, ct;
+                        simd::sincos(simd::load<V>(theta[i] + n) + _dh[i].theta_offset, st, ct);
+
+                        /* pose = pose * Rz(theta) Tz(d) Tx(a) Rx(alpha) */
+                        for(size_t row = 0; row < 3; row++) {
+                            const V u = r[row][1] * ct - r[row][0] * st;
+                            const V c0 = r[row][0] * ct + r[row][1] * st;
+                            p[row] = p[row] + _dh[i].a * c0 + _dh[i].d * r[row][2];
+                            r[row][1] = ca[i] * u + sa[i] * r[row][2];
+                            r[row][2] = ca[i] * r[row][2] - sa[i] * u;
+                            r[row][0] = c0;
+                        }
+                    }
+
+                    simd::store(x + n, p[0]);
+                    simd::store(y + n, p[1]);
+                    simd::store(z + n, p[2]);
+                }
+
+                /* Whatever is left of a whole vector */
+                if (n < count) {
+                    const double *tail[N];
+                    for(size_t i = 0; i < N; i++) tail[i] = theta[i] + n;
+                    ForwardBatch<double>(tail, count - n, x + n, y + n, z + n);
+                }
+            }
+
+            /* Joint angles of count end effector positions, theta[i][0] holds the
+             * starting guess. Points further than reach from the solution keep the
+             * angles of the previous point, and their number is returned */
+            template<class V = simd::lanes>
+            size_t InverseBatch(const double *x, const double *y, const double *z,
+                                const size_t &count, double *const *theta,
+                                const int &max_iterations,
+                                const double &damping,
+                                const double &tolerance,
+                                const double &reach) const
+            {
+                if (count == 0) return 0;
+
+                Angles guess;
+                for(size_t i = 0; i < N; i++) guess[i] = theta[i][0];
+
+                /* A planar RR arm has a closed form solution, and it vectorizes */
+                if ((N == 2) && Planar()) {
+                    InverseRR<V>(x, y, z, count, theta, reach);
+                } else {
+                    for(size_t n = 0; n < count; n++) {
+                        const Position target = {{{ x[n] }, { y[n] }, { z[n] }}};
+                        Angles solution = guess;
+                        const Solution result = Inverse(target, solution, max_iterations, damping, tolerance);
+                        for(size_t i = 0; i < N; i++) theta[i][n] = (result.residual > reach) ? NAN : solution[i];
+                        if (result.residual <= reach) guess = solution;
+                    }
+                }
+
+                /* Unsolved points repeat the previous solution */
+                size_t unsolved = 0;
+                for(size_t n = 0; n < count; n++) {
+                    if (std::isnan(theta[0][n]) || std::isnan(theta[N - 1][n])) {
+                        for(size_t i = 0; i < N; i++) theta[i][n] = (n == 0) ? guess[i] : theta[i][n - 1];
+                        unsolved++;
+                    }
+                }
+
+                return unsolved;
+            }
+
+        private:
+            DHParameters _dh[N];
+
+            /* Closed form solution of the planar RR arm, elbow angle positive */
+            template<class V>
+            void InverseRR(const double *x, const double *y, const double *z,
+                           const size_t &count, double *const *theta, const double &reach) const
+            {
+                const size_t w = simd::width<V>::value;
+                const double l0 = _dh[0].a, l1 = _dh[N - 1].a;
+                const double outer = (l0 + l1 + reach) * (l0 + l1 + reach);
+                const double inner = std::max(0.0, std::abs(l0 - l1) - reach) * std::max(0.0, std::abs(l0 - l1) - reach);
+
+                size_t n = 0;
+                for(; n + w <= count; n += w) {
+                    const V px = simd::load<V>(x + n), py = simd::load<V>(y + n), pz = simd::load<V>(z + n);
+                    const V r2 = px * px + py * py;
+
+                    /* Cosine and sine of the elbow angle, clamped on the workspace border */
+                    V d = (r2 - l0 * l0 - l1 * l1) / (2 * l0 * l1);
+                    d = (d > 1.0) ? (V() + 1.0) : d;
+                    d = (d < -1.0) ? (V() - 1.0) : d;
+                    const V sd = simd::sqrt(1.0 - d * d);
+
+                    V t1 = simd::atan2(sd, d);
+                    V t0 = simd::atan2(py, px) - simd::atan2(l1 * sd, l0 + l1 * d);
+
+                    /* Out of reach, or off the plane */
+                    const auto lost = (r2 > outer) | (r2 < inner) | (simd::abs(pz) > reach);
+                    t0 = lost ? (V() + NAN) : t0;
+                    t1 = lost ? (V() + NAN) : t1;
+
+                    simd::store(theta[0] + n, t0);
+                    simd::store(theta[N - 1] + n, t1);
+                }
+
+                if (n < count) {
+                    double *tail[N];
+                    for(size_t i = 0; i < N; i++) tail[i] = theta[i] + n;
+                    InverseRR<double>(x + n, y + n, z + n, count - n, tail, reach);
+                }
+            }
+
+            static Position Error(const Position &target, const Transform &pose)
+            {
+                Position e;
+                for(size_t d = 0; d < 3; d++) e.m[d][0] = target.m[d][0] - pose.m[d][3];
+                return e;
+            }
+
+            static double Norm(const Position &v)
+            {
+                return std::sqrt(v.m[0][0] * v.m[0][0] + v.m[1][0] * v.m[1][0] + v.m[2][0] * v.m[2][0]);
+            }
+    };
+}
@@ -4,50 +4,64 @@
  * for DC motors. Using this class for H-Bridge PWM cont-
  * -rolled DC motors.
  *
+ * Every value written to the PWM channels is cached in memory, so the
+ * control loop only pays for a sysfs write when the duty cycle or the
+ * direction really change, and the duty_cycle files are kept open to be
+ * rewritten with a single pwrite() instead of an open/write/close.
+ * Alternatively the channels can be driven through the mapped registers
+ * of the PWM block (see PWMRegisters), where an update is a plain store.
+ *
  * References:
  * https://github.com/oxavelar/HighLatencyPWM
+ * https://www.kernel.org/doc/Documentation/pwm.txt
  *
  */
 
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
 #include "Motor.h"
+#include "../toolbox.h"
 
 
-Motor::Motor(const int &pin_pwm_a, const int &pin_pwm_b)
+Motor::Motor(const int &pin_pwm_a, const int &pin_pwm_b,
+             const std::shared_ptr<PWMRegisters> &registers) :
+    _registers(registers),
+    _speed_backup(0),
+    _deadband_percent(0),
+    _deadband_duty(0)
 {
-    /* DC motor control is performed with PWM sysfs abstraction */
-    _pwm_a = std::shared_ptr<PWM>(new PWM(pin_pwm_a));
-    _pwm_b = std::shared_ptr<PWM>(new PWM(pin_pwm_b));
-    
     /* Operational values being calculated for default base freq */
     const double t = (1 / (double)BASE_PWM_FREQUENCY_HZ);
-    const PWM::Period _pwm_period_ns = (t * 1E9);
-    const PWM::Duty _pwm_dutycycle_ns = (BASE_PWM_DUTYCYCLE * t * 1E9 / 100);
+    _period = (t * 1E9);
     
-    _pwm_a->setPeriod(_pwm_period_ns);
-    _pwm_b->setPeriod(_pwm_period_ns);
-    _pwm_a->setDuty(_pwm_dutycycle_ns);
-    _pwm_b->setDuty(_pwm_dutycycle_ns);
+    /* DC motor control is performed with PWM sysfs abstraction, or the registers */
+    OpenChannel(_channel_a, pin_pwm_a);
+    OpenChannel(_channel_b, pin_pwm_b);
 
     /* Starts up the PWM pins */    
     Enabled();
 
     /* Defaults to channel A as active */
-    _pwm_active = _pwm_a;
+    _channel_active = &_channel_a;
 
     /* Duty value limits ranges from 0% to 100% */
     ApplyRangeLimits();
 
     /* Useful information to be printed regarding set-up */
-    std::cout << "I: Userspace motor created @ (pinPWM_A=" 
-              << pin_pwm_a
-              << " pinPWM_B="
-              << pin_pwm_b
-              << ")" << std::endl;
-    std::cout << "   operating on a PWM frequency of "
-              << BASE_PWM_FREQUENCY_HZ << "Hz with " << BASE_PWM_DUTYCYCLE
-              << "% duty cycle" << std::endl;
+    logger << "I: Userspace motor created @ (pinPWM_A="
+           << pin_pwm_a
+           << " pinPWM_B="
+           << pin_pwm_b
+           << ")" << std::endl;
+    logger << "   operating on a PWM frequency of "
+           << BASE_PWM_FREQUENCY_HZ << "Hz with " << BASE_PWM_DUTYCYCLE
+           << "% duty cycle" << std::endl;
+    if (_registers) logger << "   driven through the mapped PWM registers" << std::endl;
 }
 
 
@@ -55,6 +69,73 @@ Motor::~Motor(void)
 {
     Disabled();
     Stop();
+
+    if (_channel_a.duty_fd >= 0) close(_channel_a.duty_fd);
+    if (_channel_b.duty_fd >= 0) close(_channel_b.duty_fd);
+}
+
+
+void Motor::OpenChannel(Channel &channel, const int &pin)
+{
+    const PWM::Duty duty = (BASE_PWM_DUTYCYCLE * _period / 100);
+
+    channel.pin = pin;
+    channel.duty = duty;
+    /* Unknown until we write it, Enabled() takes care of it */
+    channel.state = PWM::State::DISABLED;
+    channel.duty_fd = -1;
+
+    if (_registers) {
+        _registers->SetPeriod(pin, _period);
+        _registers->SetDuty(pin, duty);
+        return;
+    }
+
+    channel.pwm = std::shared_ptr<PWM>(new PWM(pin));
+    channel.pwm->setPeriod(_period);
+    channel.pwm->setDuty(duty);
+
+#ifndef SIMULATED_PLANT
+    /* The PWM object exported the channel, its duty file stays open from now on */
+    const std::string path = std::string(PWM_SYSFS_CHIP) + "/pwm" + std::to_string(pin) + "/duty_cycle";
+    channel.duty_fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (channel.duty_fd < 0) {
+        logger << "W: Unable to keep " << path << " open, "
+               << "duty cycle updates will go through the PWM library" << std::endl;
+    }
+#endif
+}
+
+
+void Motor::WriteDuty(Channel &channel, const PWM::Duty &duty)
+{
+    /* Nothing to tell the hardware, it already has this value */
+    if (duty == channel.duty) return;
+
+    bool written = false;
+
+    if (_registers) {
+        _registers->SetDuty(channel.pin, duty);
+        written = true;
+    } else if (channel.duty_fd >= 0) {
+        char text[24];
+        const int length = std::snprintf(text, sizeof(text), "%lu", (unsigned long)duty);
+        written = (pwrite(channel.duty_fd, text, length, 0) == length);
+    }
+
+    if (!written) channel.pwm->setDuty(duty);
+
+    channel.duty = duty;
+}
+
+
+void Motor::WriteState(Channel &channel, const PWM::State &state)
+{
+    if (state == channel.state) return;
+
+    if (_registers) _registers->SetState(channel.pin, state == PWM::State::ENABLED);
+    else            channel.pwm->setState(state);
+    channel.state = state;
 }
 
 
@@ -66,25 +147,25 @@ void Motor::Start(void)
 
 void Motor::Stop(void)
 {
-    _speed_backup = GetSpeed();
+    /* The last commanded speed stays in _speed_backup for Start() */
 
     /* Set both PWM outputs to the same lowest value */
-    _pwm_a->setDuty(0);
-    _pwm_b->setDuty(0);
+    WriteDuty(_channel_a, 0);
+    WriteDuty(_channel_b, 0);
 }
 
 
 void Motor::Enabled(void)
 {
-    _pwm_a->setState(PWM::State::ENABLED);
-    _pwm_b->setState(PWM::State::ENABLED);
+    WriteState(_channel_a, PWM::State::ENABLED);
+    WriteState(_channel_b, PWM::State::ENABLED);
 }
 
 
 void Motor::Disabled(void)
 {
-    _pwm_a->setState(PWM::State::DISABLED);
-    _pwm_b->setState(PWM::State::DISABLED);
+    WriteState(_channel_a, PWM::State::DISABLED);
+    WriteState(_channel_b, PWM::State::DISABLED);
 }
 
 double Motor::GetSpeed(void)
@@ -92,7 +173,7 @@ double Motor::GetSpeed(void)
     /* Reverse translates the PWM duty cycle to speed % */
     double speed;
     
-    speed = _pwm_active->getDuty() - _minimum_duty;
+    speed = _channel_active->duty - _minimum_duty;
     speed = speed / (double)_range_compression_factor;
     speed = 100 * speed / (double)_maximum_duty;
     
@@ -102,14 +183,30 @@ double Motor::GetSpeed(void)
 
 void Motor::SetSpeed(const double &percent)
 {
+    /* Register updates the PWM block had not latched yet go out from here,
+     * the control loop comes by every iteration */
+    if (_registers) {
+        _registers->Flush(_channel_a.pin);
+        _registers->Flush(_channel_b.pin);
+    }
+
     /* Translates the speed percentage to a PWM duty cycle */
     double val = (_maximum_duty - _minimum_duty) * percent / (double)100;
     
     /* Saturate our value range to fit our conditions */
     val = std::min(val + _minimum_duty, _maximum_duty);
     
+    /* Small corrections are dropped, but the range ends are always reached */
+    const PWM::Duty duty = val;
+    const bool saturated = (duty == (PWM::Duty)_minimum_duty) || (duty == (PWM::Duty)_maximum_duty);
+
     /* Value is now protected from 0 to 100 ranges at most */
-    _pwm_active->setDuty(val);
+    if (saturated || (std::abs((double)duty - (double)_channel_active->duty) >= _deadband_duty)) {
+        WriteDuty(*_channel_active, duty);
+    }
+
+    /* Remembered so a Stop() and Start() sequence can resume it */
+    _speed_backup = percent;
 }
 
 
@@ -121,35 +218,50 @@ void Motor::ApplyRangeLimits(const double &percent_l, const double &percent_h)
         _maximum_percent = percent_h;
         
         /* Minimum motor operating duty cycle */
-        _minimum_duty = (double)_pwm_active->getPeriod() / (double)100 * percent_l;
+        _minimum_duty = (double)_period / (double)100 * percent_l;
         /* Maximum motor operating duty cycle */
-        _maximum_duty = (double)_pwm_active->getPeriod() / (double)100 * percent_h;
+        _maximum_duty = (double)_period / (double)100 * percent_h;
         
         /* Updates our compressed range for calculations */
         _range_compression_factor = (percent_h - percent_l) / (double)100;
+
+        /* The deadband follows the usable range */
+        SetDeadband(_deadband_percent);
     } else {
         throw std::runtime_error("Invalid speed range limit values");
     }
 }
 
 
+void Motor::SetDeadband(const double &percent)
+{
+    if (percent < 0) throw std::runtime_error("Invalid speed deadband value");
+
+    _deadband_percent = percent;
+    _deadband_duty = (_maximum_duty - _minimum_duty) * percent / (double)100;
+}
+
+
 Motor::Direction Motor::GetDirection(void)
 {
     Direction dir = Direction::CW;
-    if     ( _pwm_active == _pwm_a ) return Direction::CW;
-    else if( _pwm_active == _pwm_b ) return Direction::CCW;
+    if     ( _channel_active == &_channel_a ) return Direction::CW;
+    else if( _channel_active == &_channel_b ) return Direction::CCW;
     return(dir);
 }
 
 
 void Motor::SetDirection(const Direction &dir)
 {
+    /* Already going that way, the hardware does not need to hear about it */
+    if (dir == GetDirection()) return;
+
     /* Save speed and state to perform the new setting switch */
     Stop();
 
     /* Move the direction pin depending which way you want to go */
-    if     ( dir == Direction::CW )  _pwm_active = _pwm_a;
-    else if( dir == Direction::CCW ) _pwm_active = _pwm_b;
+    if     ( dir == Direction::CW )  _channel_active = &_channel_a;
+    else if( dir == Direction::CCW ) _channel_active = &_channel_b;
     
     /* Override new values from the other channel */
     Start();
@@ -162,8 +274,10 @@ Motor::State Motor::GetState(void)
     State status = State::RUNNING;
 
     /* If both pwm duties are equal, it means it is stopped */
-    if( _pwm_a->getDuty() == _pwm_a->getDuty() ) status = State::STOPPED;
+    if( _channel_a.duty == _channel_b.duty ) status = State::STOPPED;
+    /* Same thing when nothing is being driven at all */
+    if( (_channel_a.state == PWM::State::DISABLED) &&
+        (_channel_b.state == PWM::State::DISABLED) ) status = State::STOPPED;
     
     return(status);
 }
-
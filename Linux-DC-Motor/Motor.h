@@ -1,7 +1,13 @@
 #pragma once
 #include <chrono>
+#include <memory>
+#include "PWMRegisters.h"
+#ifdef SIMULATED_PLANT
+#include "../Linux-Simulated-Plant/SimulatedPlant.h"
+#else
 #include "../HighLatencyPWM/PWM.hh"
 #include "../HighLatencyGPIO/GPIO.hh"
+#endif
 
 #ifndef BASE_PWM_FREQUENCY_HZ
 #define BASE_PWM_FREQUENCY_HZ 25000
@@ -11,6 +17,11 @@
 #define BASE_PWM_DUTYCYCLE 0
 #endif
 
+/* Sysfs PWM chip the motor pins belong to, its duty files are kept open */
+#ifndef PWM_SYSFS_CHIP
+#define PWM_SYSFS_CHIP "/sys/class/pwm/pwmchip0"
+#endif
+
 
 class Motor
 {
@@ -18,7 +29,9 @@ class Motor
         enum class State : char { STOPPED, RUNNING };
         enum class Direction { CCW, CW };
 
-        explicit Motor(const int &pin_pwm_a, const int &pin_pwm_b);
+        /* With registers the pins are channels of that mapped PWM block */
+        explicit Motor(const int &pin_pwm_a, const int &pin_pwm_b,
+                       const std::shared_ptr<PWMRegisters> &registers = nullptr);
         virtual ~Motor(void);
 
         void Stop(void);
@@ -29,6 +42,8 @@ class Motor
         void SetSpeed(const double &percent);
         void ApplyRangeLimits(const double &percent_l = 0, 
                               const double &percent_h = 100);
+        /* Speed changes smaller than this % of the range are not written */
+        void SetDeadband(const double &percent);
 
         Direction GetDirection(void);
         void SetDirection(const Direction &dir);
@@ -36,15 +51,32 @@ class Motor
         State GetState(void);
 
     private:
+        /* One side of the H-Bridge, with what was last written to it */
+        struct Channel
+        {
+            unsigned pin;
+            std::shared_ptr<PWM> pwm;
+            int duty_fd;
+            PWM::Duty duty;
+            PWM::State state;
+        };
+
         /* External world interactions to the H-Bridge */
-        std::shared_ptr<PWM> _pwm_a;
-        std::shared_ptr<PWM> _pwm_b;
-        std::shared_ptr<PWM> _pwm_active;
+        Channel _channel_a;
+        Channel _channel_b;
+        Channel *_channel_active;
+        /* Mapped PWM block, the sysfs PWM objects are not used when present */
+        const std::shared_ptr<PWMRegisters> _registers;
+        PWM::Period _period;
         /* Used to keep track of stopped motor */
         double _speed_backup;
         /* We can set hard limits to the percentage of PWM channels */
         double _range_compression_factor;
         double _minimum_percent, _maximum_percent;
         double _minimum_duty, _maximum_duty;
-};
+        double _deadband_percent, _deadband_duty;
 
+        void OpenChannel(Channel &channel, const int &pin);
+        void WriteDuty(Channel &channel, const PWM::Duty &duty);
+        void WriteState(Channel &channel, const PWM::State &state);
+};
@@ -0,0 +1,171 @@
+/*
+ * Memory mapped access to the PWM controller of the Edison (Merrifield),
+ * the same LPSS PWM block the kernel pwm-lpss driver talks to. Each
+ * channel has a control register, 0x400 bytes apart from the next one:
+ *
+ *   bit 31     enable
+ *   bit 30     software update, latches the new values on the next period
+ *              and reads back as set until it did
+ *   bits 29:8  base unit, the output frequency as a fraction of the clock
+ *   bits 7:0   on time divisor, 255 minus the duty cycle in 1/255 steps
+ *
+ * The block is reached through its PCI resource file (or /dev/mem, or a
+ * UIO device), and since it only takes an mmap() able file, a regular
+ * file can stand in for it to try the whole motor path on any Linux box.
+ *
+ * References:
+ * https://github.com/torvalds/linux/blob/master/drivers/pwm/pwm-lpss.c
+ * https://www.kernel.org/doc/html/latest/driver-api/uio-howto.html
+ *
+ */
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "PWMRegisters.h"
+
+/* Distance between the registers of two channels */
+#define channel_stride (size_t)0x400
+/* Input clock and width of the base unit field, as used by pwm-lpss */
+#define pwm_clock_hz (double)19.2E6
+#define base_unit_bits (unsigned)22
+/* Control register fields */
+#define control_enable (uint32_t)(1U << 31)
+#define control_sw_update (uint32_t)(1U << 30)
+#define on_time_max (uint64_t)255
+
+
+PWMRegisters::PWMRegisters(const std::string &device, const off_t &offset) :
+    _fd(-1),
+    _map(MAP_FAILED),
+    _map_length(_channels_nr * channel_stride)
+{
+    if (offset % sysconf(_SC_PAGESIZE)) {
+        throw std::runtime_error("PWM register block offset is not page aligned");
+    }
+
+    _fd = open(device.c_str(), O_RDWR | O_SYNC | O_CLOEXEC);
+    if (_fd < 0) {
+        throw std::runtime_error("Unable to open " + device + ": " + std::strerror(errno));
+    }
+
+    /* A regular file standing in for the registers is grown to fit them */
+    struct stat info;
+    if ((fstat(_fd, &info) == 0) && S_ISREG(info.st_mode) &&
+        (info.st_size < (off_t)(offset + _map_length))) {
+        if (ftruncate(_fd, offset + _map_length) < 0) {
+            const int error = errno;
+            close(_fd);
+            throw std::runtime_error("Unable to size " + device + ": " + std::strerror(error));
+        }
+    }
+
+    _map = mmap(NULL, _map_length, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, offset);
+    if (_map == MAP_FAILED) {
+        const int error = errno;
+        close(_fd);
+        throw std::runtime_error("Unable to map " + device + ": " + std::strerror(error));
+    }
+
+    for(auto &channel : _channels) channel = { 0, 0, false, false };
+}
+
+
+PWMRegisters::~PWMRegisters(void)
+{
+    munmap(_map, _map_length);
+    close(_fd);
+}
+
+
+volatile uint32_t *PWMRegisters::Control(const unsigned &channel)
+{
+    if (channel >= _channels_nr) throw std::runtime_error("Invalid PWM register channel");
+    return reinterpret_cast<volatile uint32_t *>(static_cast<char *>(_map) + channel * channel_stride);
+}
+
+
+void PWMRegisters::SetPeriod(const unsigned &channel, const unsigned long &period)
+{
+    Control(channel);
+    _channels[channel].period = period;
+    Update(channel);
+}
+
+
+void PWMRegisters::SetDuty(const unsigned &channel, const unsigned long &duty)
+{
+    Control(channel);
+    _channels[channel].duty = duty;
+    Update(channel);
+}
+
+
+void PWMRegisters::SetState(const unsigned &channel, const bool &enabled)
+{
+    volatile uint32_t *reg = Control(channel);
+    _channels[channel].enabled = enabled;
+
+    /* Like pwm-lpss, turning the output off needs no latch and never waits */
+    if (!enabled) {
+        *reg = *reg & ~control_enable;
+        return;
+    }
+
+    Update(channel);
+}
+
+
+bool PWMRegisters::Flush(const unsigned &channel)
+{
+    Control(channel);
+    if (!_channels[channel].pending) return true;
+    return Update(channel);
+}
+
+
+uint32_t PWMRegisters::GetControl(const unsigned &channel)
+{
+    return *Control(channel);
+}
+
+
+bool PWMRegisters::Update(const unsigned &channel)
+{
+    Channel &c = _channels[channel];
+    volatile uint32_t *reg = Control(channel);
+    const uint32_t current = *reg;
+
+    /* The previous update has not latched yet, pwm-lpss refuses with -EBUSY
+     * here. Writing over it could lose it, so this one waits its turn */
+    if (current & control_sw_update) {
+        c.pending = true;
+        return false;
+    }
+
+    uint32_t control = 0;
+
+    if (c.period) {
+        /* Output frequency relative to the input clock, on the base unit scale */
+        const uint64_t range = 1ULL << base_unit_bits;
+        const uint64_t base_unit = std::llround(1E9 / c.period * range / pwm_clock_hz) & (range - 1);
+        const uint64_t on_time = on_time_max * std::min(c.duty, c.period) / c.period;
+        control = (base_unit << 8) | (on_time_max - on_time);
+    }
+
+    /* Same order as pwm-lpss: the new values with the output as it was,
+     * then ask for them to be latched, then turn the output on if needed */
+    control |= current & control_enable;
+    *reg = control;
+    *reg = control | control_sw_update;
+    if (c.enabled && !(current & control_enable)) *reg = control | control_sw_update | control_enable;
+
+    c.pending = false;
+    return true;
+}
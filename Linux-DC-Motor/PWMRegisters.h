@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The control registers of an Intel LPSS style PWM block mapped into our
+ * address space, one 32 bit register per channel. Writing them directly
+ * replaces the sysfs round trip of every duty cycle update with a store.
+ * The block latches new values on its next period only, an update asked
+ * for before that is kept back and written by a later call on the channel.
+ */
+
+
+class PWMRegisters
+{
+    public:
+        /* Offset is where the block starts in the device, page aligned */
+        explicit PWMRegisters(const std::string &device, const off_t &offset);
+        virtual ~PWMRegisters(void);
+
+        /* Owns the device and its mapping, not to be copied */
+        PWMRegisters(const PWMRegisters &) = delete;
+        PWMRegisters &operator=(const PWMRegisters &) = delete;
+
+        /* Same units as the sysfs interface, nanoseconds */
+        void SetPeriod(const unsigned &channel, const unsigned long &period);
+        void SetDuty(const unsigned &channel, const unsigned long &duty);
+        void SetState(const unsigned &channel, const bool &enabled);
+
+        /* Writes what was kept back while the last update had not latched,
+         * returns false when it still has to wait for the hardware */
+        bool Flush(const unsigned &channel);
+
+        /* Raw control register value, mostly to check on a backing file */
+        uint32_t GetControl(const unsigned &channel);
+
+    private:
+        static constexpr unsigned _channels_nr = 4;
+
+        /* What the register of each channel should hold */
+        struct Channel
+        {
+            unsigned long period;
+            unsigned long duty;
+            bool enabled;
+            /* Newer values than the ones in the register, waiting for a latch */
+            bool pending;
+        };
+
+        int _fd;
+        void *_map;
+        size_t _map_length;
+        Channel _channels[_channels_nr];
+
+        volatile uint32_t *Control(const unsigned &channel);
+        bool Update(const unsigned &channel);
+};
@@ -0,0 +1,137 @@
+/*
+ * Edge events from the Linux GPIO character device (uAPI v2), as an
+ * alternative to the sysfs value/edge files used by HighLatencyGPIO.
+ *
+ * The lines are requested as inputs with edge detection, the kernel
+ * timestamps each edge in its interrupt handler and queues it, so a
+ * single read() returns every edge that happened since the previous
+ * one. It can be exercised without hardware through the gpio-sim
+ * kernel module.
+ *
+ * References:
+ * https://www.kernel.org/doc/html/latest/userspace-api/gpio/chardev.html
+ * https://www.kernel.org/doc/html/latest/admin-guide/gpio/gpio-sim.html
+ *
+ */
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "GPIOChardev.h"
+
+/* Events kept by the kernel for us, and read back per system call */
+#define event_buffer_depth (unsigned)256
+#define events_per_read (size_t)64
+/* How often the event thread checks for a stop request */
+#define poll_timeout_ms (int)100
+
+
+GPIOChardev::GPIOChardev(const std::string &chip,
+                         const std::vector<unsigned> &offsets,
+                         const std::string &consumer,
+                         const Callback &callback) :
+    _line_fd(-1),
+    _offsets(offsets),
+    _lines_nr(offsets.size()),
+    _callback(callback),
+    _event_thread_stop_event(false)
+{
+    if ((_lines_nr == 0) || (_lines_nr > GPIO_V2_LINES_MAX)) {
+        throw std::runtime_error("Invalid number of GPIO lines requested");
+    }
+
+    const int chip_fd = open(chip.c_str(), O_RDONLY | O_CLOEXEC);
+    if (chip_fd < 0) {
+        throw std::runtime_error("Unable to open " + chip + ": " + std::strerror(errno));
+    }
+
+    struct gpio_v2_line_request request;
+    std::memset(&request, 0, sizeof(request));
+
+    for(size_t i = 0; i < _lines_nr; i++) request.offsets[i] = offsets[i];
+    request.num_lines = _lines_nr;
+    request.event_buffer_size = event_buffer_depth;
+    std::strncpy(request.consumer, consumer.c_str(), sizeof(request.consumer) - 1);
+    /* Both edges are needed to know the level of every line from its events */
+    request.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+                           GPIO_V2_LINE_FLAG_EDGE_RISING |
+                           GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+    const int status = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request);
+    const int error = errno;
+    close(chip_fd);
+
+    if (status < 0) {
+        throw std::runtime_error("Unable to request the lines of " + chip + ": " + std::strerror(error));
+    }
+
+    _line_fd = request.fd;
+}
+
+
+GPIOChardev::~GPIOChardev(void)
+{
+    if (_event_thread.joinable()) {
+        _event_thread_stop_event = true;
+        _event_thread.join();
+    }
+    /* Releases the lines back to the kernel */
+    close(_line_fd);
+}
+
+
+void GPIOChardev::Start(void)
+{
+    /* Edges seen before this are kept queued by the kernel */
+    _event_thread = std::thread(&GPIOChardev::EventLoop, this);
+}
+
+
+uint64_t GPIOChardev::GetValues(void)
+{
+    struct gpio_v2_line_values values;
+    values.bits = 0;
+    values.mask = (_lines_nr == 64) ? ~0ULL : ((1ULL << _lines_nr) - 1);
+
+    if (ioctl(_line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        throw std::runtime_error(std::string("Unable to read the GPIO lines: ") + std::strerror(errno));
+    }
+
+    return values.bits;
+}
+
+
+void GPIOChardev::EventLoop(void)
+{
+    struct gpio_v2_line_event raw[events_per_read];
+    Event events[events_per_read];
+    struct pollfd pfd = { _line_fd, POLLIN, 0 };
+
+    while (!_event_thread_stop_event) {
+
+        if (poll(&pfd, 1, poll_timeout_ms) <= 0) continue;
+
+        /* Everything queued since the last wake up, in one system call */
+        const ssize_t bytes = read(_line_fd, raw, sizeof(raw));
+        if (bytes <= 0) continue;
+
+        const size_t count = bytes / sizeof(raw[0]);
+
+        for(size_t i = 0; i < count; i++) {
+            events[i].timestamp_ns = raw[i].timestamp_ns;
+            events[i].rising = (raw[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+            /* The kernel reports chip offsets, translate them to request order */
+            events[i].line = 0;
+            for(size_t line = 0; line < _lines_nr; line++) {
+                if (raw[i].offset == _offsets[line]) events[i].line = line;
+            }
+        }
+
+        _callback(events, count);
+    }
+}
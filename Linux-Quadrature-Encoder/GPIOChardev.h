@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdint.h>
+
+/*
+ * Input lines requested through the kernel GPIO character device. All of the
+ * lines go in one request, and their edges come back as timestamped events
+ * that are read in batches, so no pin level has to be read back per edge.
+ */
+
+
+class GPIOChardev
+{
+    public:
+        /* Line is the index of the line in the request, not its chip offset */
+        struct Event
+        {
+            uint64_t timestamp_ns;
+            unsigned line;
+            bool rising;
+        };
+
+        typedef std::function<void(const Event *events, const size_t &count)> Callback;
+
+        explicit GPIOChardev(const std::string &chip,
+                             const std::vector<unsigned> &offsets,
+                             const std::string &consumer,
+                             const Callback &callback);
+        virtual ~GPIOChardev(void);
+
+        /* Begins delivering events, read the initial levels before this */
+        void Start(void);
+
+        /* Bit i holds the level of the line i of the request */
+        uint64_t GetValues(void);
+
+    private:
+        int _line_fd;
+        const std::vector<unsigned> _offsets;
+        const size_t _lines_nr;
+        const Callback _callback;
+
+        /* Waits for the edge events and hands them over in batches */
+        void EventLoop(void);
+        std::thread _event_thread;
+        std::atomic<bool> _event_thread_stop_event;
+};
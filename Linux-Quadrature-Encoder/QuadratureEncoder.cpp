@@ -7,8 +7,13 @@
  * to go and configurue the GPIO pins to have either 10k
  * or 20k pulldowns for less noise at the input.
  *
+ * Built with GPIO_CHARDEV the channels are read through the GPIO
+ * character device instead, both lines in one request and their
+ * edges delivered in batches, decoded from the edge polarity alone.
+ *
  * References:
  * https://github.com/tweej/HighLatencyGPIO
+ * https://www.kernel.org/doc/html/latest/userspace-api/gpio/chardev.html
  *
  */
 
@@ -16,18 +21,56 @@
 #include <stdexcept>
 #include <cmath>
 #include <iomanip>
+#include <algorithm>
+#include <sched.h>
 #include "QuadratureEncoder.h"
 
+/* Largest run of edge events decoded in one go */
+#define decode_batch_size (size_t)64
+/* Speed estimation defaults, and how many windows without edges mean stopped */
+#define default_velocity_window_ns (long long)10E06
+#define stall_windows (long long)20
+
+constexpr signed char QuadratureEncoder::_qem[16];
 
 
 QuadratureEncoder::QuadratureEncoder(const int &pin_a, const int &pin_b, const int &rate):
-    _encoder_rate(rate)
+    _prev_packed_read(0),
+    _counter(0),
+    _event_counter(0),
+    _published_sequence(0),
+    _published_count(0),
+    _published_direction((int)Direction::CW),
+    _published_timestamp_ns(0),
+    _zero_offset(0),
+    _encoder_rate(rate),
+    _velocity_window_ns(default_velocity_window_ns),
+    _edge_scheduling_set(false),
+    _edge_policy(SCHED_OTHER),
+    _edge_priority(0),
+    _edge_cpu(-1),
+    _edge_stack_prefault(0),
+    _edge_event(NULL),
+    _edge_event_threshold(1),
+    _edges_head(0)
 {
+    _decode_lock.clear();
+
+    /* No edge history yet, a valid slot never has a zero sequence */
+    for(auto &slot : _edges) slot.sequence = 0;
+
+#ifdef GPIO_CHARDEV
+    /* Levels are tracked from the edges, so every edge must be seen */
+    if (_encoder_rate != 4) {
+        throw std::runtime_error("Invalid encoder rate selected, only 4x supported on the GPIO character device");
+    }
+#else
     /* Encoder rate on single edge is 2x, and 4x for both edges */
     GPIO::Edge interrupt_mode;
     if      (_encoder_rate == 2)    interrupt_mode = GPIO::Edge::RISING;
     else if (_encoder_rate == 4)    interrupt_mode = GPIO::Edge::BOTH;
     else    throw std::runtime_error("Invalid encoder rate selected, only 2x or 4x supported");
+#endif
 
 #if DEBUG
     /* Zero out our debug counters in case of optimizations */
@@ -36,6 +79,18 @@ QuadratureEncoder::QuadratureEncoder(const int &pin_a, const int &pin_b, const i
      _gpio_processing_error_count = 0;
 #endif
 
+#ifdef GPIO_CHARDEV
+    /* One request for both channels, events are handed over in batches */
+    using namespace std::placeholders;
+    _lines = std::unique_ptr<GPIOChardev>(
+                new GPIOChardev(GPIO_CHARDEV_CHIP, { (unsigned)pin_a, (unsigned)pin_b },
+                                "quadrature-encoder",
+                                std::bind(&QuadratureEncoder::ISR_Events, this, _1, _2)));
+
+    /* The only time the levels are read, edges keep track of them afterwards */
+    _prev_packed_read = _lines->GetValues() & 0x3;
+    _lines->Start();
+#else
     /* Register our local GPIO callbacks to use for SW interrupts */
     _channel_a_callback = std::bind(&QuadratureEncoder::ISR_ChannelA, this);
     _channel_b_callback = std::bind(&QuadratureEncoder::ISR_ChannelB, this);
@@ -43,13 +98,14 @@ QuadratureEncoder::QuadratureEncoder(const int &pin_a, const int &pin_b, const i
     /* Initialize channels GPIO objects and assign local callbacks */
     _gpio_a = std::unique_ptr<GPIO>(new GPIO(pin_a, interrupt_mode, _channel_a_callback));
     _gpio_b = std::unique_ptr<GPIO>(new GPIO(pin_b, interrupt_mode, _channel_b_callback));
+#endif
     
     /* Useful information to be printed regarding set-up */
-    std::cout << "I: Userspace quadrature encoder created @ (pinA="
-              << pin_a
-              << " pinB="
-              << pin_b << ")" << std::endl; 
-    std::cout << "   operating at a rate of " << rate << "x" << std::endl;
+    logger << "I: Userspace quadrature encoder created @ (pinA="
+           << pin_a
+           << " pinB="
+           << pin_b << ")" << std::endl;
+    logger << "   operating at a rate of " << rate << "x" << std::endl;
 }
 
 
@@ -67,9 +123,33 @@ void QuadratureEncoder::SetParameters(const int &segments)
 }
 
 
+QuadratureEncoder::Snapshot QuadratureEncoder::GetSnapshot(void)
+{
+    unsigned sequence;
+    long count;
+    int direction;
+    long long timestamp_ns;
+
+    /* Retry while an edge is being published, it only takes a few stores */
+    do {
+        sequence = _published_sequence.load(std::memory_order_acquire);
+        count = _published_count.load(std::memory_order_relaxed);
+        direction = _published_direction.load(std::memory_order_relaxed);
+        timestamp_ns = _published_timestamp_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) || (sequence != _published_sequence.load(std::memory_order_relaxed)));
+
+    Snapshot snapshot;
+    snapshot.angle = 360.0 * (count - _zero_offset) / (double)_segments_per_revolution;
+    snapshot.direction = (Direction)direction;
+    snapshot.timestamp = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(timestamp_ns));
+    return snapshot;
+}
+
+
 double QuadratureEncoder::GetAngle(void)
 {
-    double degrees = 360.0 * _counter;
+    double degrees = 360.0 * (_published_count - _zero_offset);
     degrees /= (double)_segments_per_revolution;
     return degrees;
 }
@@ -77,24 +157,157 @@ double QuadratureEncoder::GetAngle(void)
 
 std::chrono::nanoseconds QuadratureEncoder::GetPeriod(void)
 {
-    return _pulse_period_ns;
+    unsigned long index;
+    long long t0, t1;
+    long c0, c1;
+
+    if (!ReadLatestEdges(index, t0, c0) || (index == 0) || !ReadEdges(index - 1, t1, c1)) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    /* A run can hold several counts, spread its time over them */
+    return std::chrono::nanoseconds((t0 - t1) / std::max(1L, std::abs(c0 - c1)));
+}
+
+
+void QuadratureEncoder::SetVelocityWindow(const std::chrono::nanoseconds &window)
+{
+    _velocity_window_ns = window.count();
+}
+
+
+double QuadratureEncoder::GetVelocity(void)
+{
+    double velocity, acceleration;
+    EstimateMotion(velocity, acceleration);
+    return velocity;
+}
+
+
+double QuadratureEncoder::GetAcceleration(void)
+{
+    double velocity, acceleration;
+    EstimateMotion(velocity, acceleration);
+    return acceleration;
 }
 
 
 void QuadratureEncoder::SetZero(void)
 {
-    _counter = 0;
+    _zero_offset = _published_count.load();
 }
 
 
 QuadratureEncoder::Direction QuadratureEncoder::GetDirection(void)
 {
-    return _direction;
+    return (Direction)_published_direction.load();
+}
+
+
+toolbox::histogram &QuadratureEncoder::GetDispatchLatency(void)
+{
+    return _dispatch_latency;
+}
+
+
+void QuadratureEncoder::SetThreadScheduling(const int &policy, const int &priority, const int &cpu,
+                                            const size_t &stack_prefault)
+{
+    _edge_policy = policy;
+    _edge_priority = priority;
+    _edge_cpu = cpu;
+    _edge_stack_prefault = stack_prefault;
+    _edge_scheduling_set.store(true, std::memory_order_release);
+}
+
+
+void QuadratureEncoder::SetEdgeEvent(toolbox::wakeup_event *event, const long &threshold)
+{
+    _edge_event_threshold = std::max(1L, threshold);
+    _edge_event.store(event, std::memory_order_release);
+}
+
+
+inline void QuadratureEncoder::ScheduleEdgeThread(void)
+{
+    /* Once per thread, the simulated plant dispatches every encoder from one
+     * so the first encoder to get there picks the settings for all of them */
+    struct Applied { bool scheduled, warned; int policy, priority, cpu; };
+    static thread_local Applied applied = { false, false, 0, 0, 0 };
+
+    if (!_edge_scheduling_set.load(std::memory_order_acquire)) return;
+
+    if (applied.scheduled) {
+        if (applied.warned || ((applied.policy == _edge_policy) && (applied.priority == _edge_priority) &&
+                               (applied.cpu == _edge_cpu))) return;
+        applied.warned = true;
+        logger << "W: Encoders sharing an edge thread are scheduled differently, it stays on "
+               << toolbox::policy_name(applied.policy) << " priority " << applied.priority << " CPU " << applied.cpu
+               << " instead of " << toolbox::policy_name(_edge_policy) << " priority " << _edge_priority
+               << " CPU " << _edge_cpu << std::endl;
+        return;
+    }
+
+    applied.scheduled = true;
+    applied.policy = _edge_policy;
+    applied.priority = _edge_priority;
+    applied.cpu = _edge_cpu;
+
+    if (_edge_stack_prefault) toolbox::prefault_stack(_edge_stack_prefault);
+    toolbox::set_thread_scheduling("encoder edge", pthread_self(), _edge_policy, _edge_priority, _edge_cpu);
+}
+
+
+#ifdef GPIO_CHARDEV
+
+void QuadratureEncoder::ISR_Events(const GPIOChardev::Event *events, const size_t &count)
+{
+    ScheduleEdgeThread();
+
+    unsigned char samples[decode_batch_size];
+    unsigned char packed = _prev_packed_read;
+
+    for(size_t first = 0; first < count; first += decode_batch_size) {
+
+        const size_t run = std::min(count - first, decode_batch_size);
+#ifdef DEBUG
+        unsigned long long channel_b_edges = 0;
+#endif
+
+        for(size_t i = 0; i < run; i++) {
+            const auto &event = events[first + i];
+            /* Channel A is bit 0 and channel B is bit 1 of the packed value */
+            const unsigned char mask = 1 << event.line;
+            packed = event.rising ? (packed | mask) : (packed & ~mask);
+            samples[i] = packed;
+#ifdef DEBUG
+            channel_b_edges += event.line;
+#endif
+        }
+
+        /* Kernel timestamps are taken from the monotonic clock, as steady_clock */
+        const std::chrono::steady_clock::time_point timestamp(
+                        std::chrono::nanoseconds(events[first + run - 1].timestamp_ns));
+        DecodeSamples(samples, run, timestamp);
+#ifdef DEBUG
+        _channel_a_isr_count += run - channel_b_edges;
+        _channel_b_isr_count += channel_b_edges;
+#endif
+    }
+
+    /* The oldest edge of the batch is the one that waited the longest */
+    if (count) {
+        const long long now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now().time_since_epoch()).count();
+        _dispatch_latency.record(std::max(0LL, now_ns - (long long)events[0].timestamp_ns));
+    }
 }
 
+#else
 
 void QuadratureEncoder::ISR_ChannelA(void)
 {
+    ScheduleEdgeThread();
     GPIO_DataProcess();
 #ifdef DEBUG
     _channel_a_isr_count++;
@@ -104,6 +317,7 @@ void QuadratureEncoder::ISR_ChannelA(void)
 
 void QuadratureEncoder::ISR_ChannelB(void)
 {
+    ScheduleEdgeThread();
     GPIO_DataProcess();
 #ifdef DEBUG
     _channel_b_isr_count++;
@@ -113,57 +327,241 @@ void QuadratureEncoder::ISR_ChannelB(void)
 
 inline void QuadratureEncoder::GPIO_DataProcess(void)
 {
+    const auto timestamp = std::chrono::steady_clock::now();
     char a, b;
-    char current_packed_read;
 
     /* Convert enum class to actual zero or one */
     _gpio_a->getValue() == GPIO::Value::HIGH ? a = 1 : a = 0;
     _gpio_b->getValue() == GPIO::Value::HIGH ? b = 1 : b = 0;
 
     /* Convert binary input to decimal value */
-    current_packed_read = (b << 1) | (a << 0);
-    /* Increment, or decrement depending on matrix */
-    auto index = _prev_packed_read * 4 + current_packed_read;
-    auto delta = _qem[index % 16];
+    const unsigned char current_packed_read = (b << 1) | (a << 0);
+    DecodeSamples(&current_packed_read, 1, timestamp);
+
+    _dispatch_latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - timestamp).count());
+}
+
+#endif
+
+
+const QuadratureEncoder::Transitions *QuadratureEncoder::TransitionTable(void)
+{
+    /* Built once from the single step matrix, shared by every encoder */
+    static const struct Table {
+        Transitions entries[256];
+        Table(void) {
+            for(unsigned index = 0; index < 256; index++) {
+                auto &entry = entries[index];
+                unsigned state = index >> 6;
+                entry.delta = entry.direction = entry.errors = 0;
+                for(int shift = 4; shift >= 0; shift -= 2) {
+                    const unsigned sample = (index >> shift) & 0x3;
+                    const auto delta = _qem[state * 4 + sample];
+                    /* Put a code guard on illegal encoder train pulse values */
+                    if (delta == 'x') {
+                        entry.errors++;
+                    } else if (delta) {
+                        entry.delta += delta;
+                        entry.direction = delta;
+                    }
+                    state = sample;
+                }
+            }
+        }
+    } table;
+
+    return table.entries;
+}
+
+
+void QuadratureEncoder::DecodeSamples(const unsigned char *packed, const size_t &count,
+                                      const std::chrono::steady_clock::time_point &timestamp)
+{
+    const Transitions *table = TransitionTable();
+
+    /* Both channel threads may decode, their edges are applied one run at a time,
+     * the holder only needs a few stores so give it the CPU if it was preempted */
+    while (_decode_lock.test_and_set(std::memory_order_acquire)) sched_yield();
+
+    /* Accumulated locally, the shared state is only touched once at the end */
+    unsigned state = _prev_packed_read;
+    long delta = 0;
+    int direction = 0;
+    unsigned errors = 0;
+    size_t i = 0;
+
+    /* Three transitions per lookup */
+    for(; i + 3 <= count; i += 3) {
+        const auto &entry = table[(state << 6) | ((packed[i] & 0x3) << 4) |
+                                  ((packed[i + 1] & 0x3) << 2) | (packed[i + 2] & 0x3)];
+        delta += entry.delta;
+        errors += entry.errors;
+        if (entry.direction) direction = entry.direction;
+        state = packed[i + 2] & 0x3;
+    }
+
+    /* Left overs go one at a time through the original matrix */
+    for(; i < count; i++) {
+        const auto step = _qem[state * 4 + (packed[i] & 0x3)];
+        if (step == 'x') {
+            errors++;
+        } else if (step) {
+            delta += step;
+            direction = step;
+        }
+        state = packed[i] & 0x3;
+    }
+
+    /* Update our previous reading, and publish the count and direction */
+    _prev_packed_read = state;
+    toolbox::wakeup_event *event = NULL;
+    long long event_timestamp_ns = 0;
+    if (delta || direction) {
+        const long long timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       timestamp.time_since_epoch()).count();
+        _counter += delta;
+
+        const unsigned sequence = _published_sequence.load(std::memory_order_relaxed);
+        _published_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _published_count.store(_counter, std::memory_order_relaxed);
+        if (direction) _published_direction.store(direction, std::memory_order_relaxed);
+        _published_timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+        _published_sequence.store(sequence + 2, std::memory_order_release);
+
+        if (delta) RecordEdges(timestamp_ns, _counter);
+
+        /* Whoever waits for the edges is woken up once we let go of the lock */
+        if (std::abs(_counter - _event_counter) >= _edge_event_threshold.load(std::memory_order_relaxed)) {
+            event = _edge_event.load(std::memory_order_acquire);
+            event_timestamp_ns = timestamp_ns;
+            if (event) _event_counter = _counter;
+        }
+    }
 
-    /* Put a code guard on illegal encoder train pulse values */
-    if (delta == 'x') {
 #ifdef DEBUG
-        _gpio_processing_error_count++;
-        //std::cout << "W: Execution might be too slow, reading wrong values from the encoder" << std::endl;
+    if (errors) _gpio_processing_error_count.fetch_add(errors, std::memory_order_relaxed);
+#else
+    (void)errors;
 #endif
-        delta = 0;
+
+    _decode_lock.clear(std::memory_order_release);
+
+    if (event) event->signal(event_timestamp_ns);
+}
+
+
+void QuadratureEncoder::RecordEdges(const long long &timestamp_ns, const long &count)
+{
+    /* Only called with the decode lock held, there is a single writer */
+    const unsigned long index = _edges_head.load(std::memory_order_relaxed);
+    _edges_head.store(index + 1, std::memory_order_relaxed);
+    auto &slot = _edges[index % edge_history];
+
+    /* Odd while it is being written, readers skip it */
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+    slot.count.store(count, std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+
+bool QuadratureEncoder::ReadEdges(const unsigned long &index, long long &timestamp_ns, long &count)
+{
+    const auto &slot = _edges[index % edge_history];
+    const unsigned long sequence = 2 * index + 2;
+
+    if (slot.sequence.load(std::memory_order_acquire) != sequence) return false;
+    timestamp_ns = slot.timestamp_ns.load(std::memory_order_relaxed);
+    count = slot.count.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    /* Still the same entry, it was not recycled while we were reading it */
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+
+bool QuadratureEncoder::ReadLatestEdges(unsigned long &index, long long &timestamp_ns, long &count)
+{
+    const unsigned long head = _edges_head.load(std::memory_order_acquire);
+
+    /* The very last run may still be in flight, fall back to the one before */
+    for(index = head; (index > 0) && (head - index < 2); ) {
+        if (ReadEdges(--index, timestamp_ns, count)) return true;
     }
-    
-    /* Update our rotation direction now, casting to enum */
-    if (delta) _direction = (Direction)delta;
-    
-    /* Update our local tracking variable */
-    _counter += delta;
-    
-    /* Update our previous reading */
-    _prev_packed_read = current_packed_read;
+    return false;
 }
 
 
-void QuadratureEncoder::TrackChannelPulseWidth(void)
+void QuadratureEncoder::EstimateMotion(double &velocity, double &acceleration)
 {
-    /* 
-     * Will only be called from a single ISR, a single channel
-     * shall provide us with the information for pulse-width
-     * tracking. 
-     */
-    const auto now = std::chrono::high_resolution_clock::now();
-    
-    if(_internal_toggle++ % 2) {
-        _isr_timestamp = now;
+    const long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch()).count();
+    const long long window = _velocity_window_ns;
+
+    unsigned long newest;
+    long long t_newest, t_middle, t_oldest, t;
+    long c_newest, c_middle, c_oldest, c;
+
+    velocity = acceleration = 0;
+
+    /* Nothing moved for a while, we are standing still */
+    if (!ReadLatestEdges(newest, t_newest, c_newest)) return;
+    if (now - t_newest > window * stall_windows) return;
+
+    /* Walk back over the window, the middle one starts its newer half */
+    t_middle = t_oldest = t_newest;
+    c_middle = c_oldest = c_newest;
+    size_t runs = 0;
+
+    for(unsigned long index = newest; (index > 0) && (newest - index < edge_history - 1); index--) {
+        if (!ReadEdges(index - 1, t, c) || (t < now - window)) break;
+        t_oldest = t;
+        c_oldest = c;
+        if (t >= now - window / 2) {
+            t_middle = t;
+            c_middle = c;
+        }
+        runs++;
+    }
+
+    if ((runs >= 2) && (t_newest > t_oldest)) {
+
+        /* Frequency method, counts over the time they took within the window */
+        velocity = (c_newest - c_oldest) / (double)(t_newest - t_oldest);
+
+        if ((t_newest > t_middle) && (t_middle > t_oldest)) {
+            const double newer = (c_newest - c_middle) / (double)(t_newest - t_middle);
+            const double older = (c_middle - c_oldest) / (double)(t_middle - t_oldest);
+            acceleration = (newer - older) / ((t_newest - t_oldest) / 2.0);
+        }
+
     } else {
-        /* Calculate the pulsewidth on even transitions */
-        auto delta = now - _isr_timestamp;
-        _pulse_period_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(delta);
+
+        /* Period method, too few edges in the window so use the last intervals */
+        long long t1, t2;
+        long c1, c2;
+        if ((newest < 1) || !ReadEdges(newest - 1, t1, c1) || (t_newest <= t1)) return;
+
+        /* Until the next edge shows up we can only be slower than the last period */
+        velocity = (c_newest - c1) / (double)std::max(t_newest - t1, now - t_newest);
+
+        if ((newest >= 2) && ReadEdges(newest - 2, t2, c2) && (t1 > t2)) {
+            const double previous = (c1 - c2) / (double)(t1 - t2);
+            acceleration = (velocity - previous) / ((t_newest - t2) / 2.0);
+        }
+
     }
+
+    /* Counts per nanosecond into degrees per second */
+    const double scale = 360.0 / _segments_per_revolution * 1E09;
+    velocity *= scale;
+    acceleration *= scale * 1E09;
 }
 
+
 #ifdef DEBUG
 
 /* The following piece of code is only useful for debug statistics it will collect
@@ -174,15 +572,21 @@ void QuadratureEncoder::TrackChannelPulseWidth(void)
 
 void QuadratureEncoder::PrintDebugStats(void)
 {
-    double gpio_error_rate = 100 * _gpio_processing_error_count / (double)
-                             (_channel_a_isr_count + _channel_b_isr_count);
-    std::cout << "D: Internal counter value   " << _counter << std::endl;
-    std::cout << "D: ChannelA interrupts      " << _channel_a_isr_count << std::endl;
-    std::cout << "D: ChannelB interrupts      " << _channel_b_isr_count << std::endl;
-    std::cout << "D: GPIO processing errors   " << _gpio_processing_error_count << std::endl;
-    std::cout << std::fixed << std::setprecision(2);
-    std::cout << "D: GPIO error rate          " << gpio_error_rate << "%" << std::endl;
-    std::cout << std::endl;
+    /* Edges decoded straight through DecodeSamples never went through an interrupt */
+    const unsigned long long interrupts = _channel_a_isr_count + _channel_b_isr_count;
+    logger << "D: Internal counter value   " << (_counter - _zero_offset) << std::endl;
+    logger << "D: ChannelA interrupts      " << _channel_a_isr_count << std::endl;
+    logger << "D: ChannelB interrupts      " << _channel_b_isr_count << std::endl;
+    logger << "D: GPIO processing errors   " << _gpio_processing_error_count << std::endl;
+    /* Formats stick on the drain thread, the lines logged after this one get the defaults back */
+    if (interrupts) {
+        logger << "D: GPIO error rate          " << std::fixed << std::setprecision(2)
+               << 100 * _gpio_processing_error_count / (double)interrupts << "%"
+               << std::defaultfloat << std::setprecision(6) << std::endl;
+    } else {
+        logger << "D: GPIO error rate          n/a" << std::endl;
+    }
+    logger << std::endl;
 }
 #endif
 
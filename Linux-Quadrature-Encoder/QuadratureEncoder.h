@@ -2,7 +2,24 @@
 #include <iostream>
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include "../toolbox.h"
+#if defined(GPIO_CHARDEV) && defined(SIMULATED_PLANT)
+#error "The simulated plant only drives the sysfs GPIO interface, build without GPIO_CHARDEV"
+#endif
+
+#ifdef GPIO_CHARDEV
+#include "GPIOChardev.h"
+#elif defined(SIMULATED_PLANT)
+#include "../Linux-Simulated-Plant/SimulatedPlant.h"
+#else
 #include "../HighLatencyGPIO/GPIO.hh"
+#endif
+
+/* Character device the encoder lines belong to, pins are its line offsets */
+#ifndef GPIO_CHARDEV_CHIP
+#define GPIO_CHARDEV_CHIP "/dev/gpiochip0"
+#endif
 
 
 class QuadratureEncoder
@@ -10,16 +27,63 @@ class QuadratureEncoder
     public:
         enum class Direction : int { CCW = -1, CW = 1 };
 
+        /* Angle in degrees, direction and time of the last decoded edge,
+         * always taken from the same update of the encoder */
+        struct Snapshot {
+            double angle;
+            Direction direction;
+            std::chrono::steady_clock::time_point timestamp;
+        };
+
         explicit QuadratureEncoder(const int &pin_a, const int &pin_b, const int &rate=4);
         virtual ~QuadratureEncoder(void);
         
+        Snapshot GetSnapshot(void);
         double GetAngle(void);
         void SetZero(void);
         Direction GetDirection(void);
         void SetParameters(const int &segments);
+        /* Time between the last two counts */
         std::chrono::nanoseconds GetPeriod(void);
 
+        /* Speed estimation from the edge timestamps, in degrees/s and degrees/s^2,
+         * averaged over the window at high speed and from single periods when slow */
+        void SetVelocityWindow(const std::chrono::nanoseconds &window);
+        double GetVelocity(void);
+        double GetAcceleration(void);
+
+        /* Decodes a run of packed (B << 1 | A) samples from any edge source, the
+         * count and direction are published once for the whole run, timestamp is
+         * when the last sample of the run was taken */
+        void DecodeSamples(const unsigned char *packed, const size_t &count,
+                           const std::chrono::steady_clock::time_point &timestamp);
+
+        /* Nanoseconds from an edge until its count is published, the edge time is
+         * the kernel timestamp on the GPIO character device and the start of the
+         * interrupt callback otherwise, as sysfs does not timestamp the edges */
+        toolbox::histogram &GetDispatchLatency(void);
+
+        /* The edge threads belong to the GPIO backend, so each one moves itself to
+         * this scheduling policy, priority and CPU (-1 unpinned) on its first edge
+         * once set, and faults in that many bytes of its stack. Encoders sharing
+         * an edge thread keep the settings of the first one, with a warning */
+        void SetThreadScheduling(const int &policy, const int &priority, const int &cpu,
+                                 const size_t &stack_prefault = 0);
+
+        /* Signals the event from the edge thread every time the count moved by
+         * threshold counts or more since the last signal, with the time of the
+         * edge that did it, so a control loop can sleep until there is news.
+         * A NULL event stops the signals */
+        void SetEdgeEvent(toolbox::wakeup_event *event, const long &threshold = 1);
+
     private:
+#ifdef GPIO_CHARDEV
+        /* Both channels in a single line request, A is line 0 and B line 1 */
+        std::unique_ptr<GPIOChardev> _lines;
+
+        /* Batches of edge events, levels are tracked from the edges */
+        void ISR_Events(const GPIOChardev::Event *events, const size_t &count);
+#else
         /* Pulse train inputs objects from the GPIO class */
         std::unique_ptr<GPIO> _gpio_a;
         std::unique_ptr<GPIO> _gpio_b;
@@ -31,6 +95,7 @@ class QuadratureEncoder
         /* Callback references to be used by GPIO class */
         std::function<void(GPIO::Value)> _channel_a_callback;
         std::function<void(GPIO::Value)> _channel_b_callback;
+#endif
         
         /* Quadrature Encoder Matrix for conversion
            http://letsmakerobots.com/content/how-use-quadrature-encoder
@@ -46,29 +111,83 @@ class QuadratureEncoder
         */
         inline void GPIO_DataProcess(void);
 
-        std::atomic<int> _prev_packed_read;
-        const signed char _qem[16] = {0,-1,1,'x',1,0,'x',-1,-1,'x',0,1,'x',1,-1,0};
+        /* Called first thing by every edge callback */
+        inline void ScheduleEdgeThread(void);
+
+        static constexpr signed char _qem[16] = {0,-1,1,'x',1,0,'x',-1,-1,'x',0,1,'x',1,-1,0};
+
+        /* The matrix above applied to three samples at once, indexed by the
+           previous state and the next three samples, 2 bits each */
+        struct Transitions { signed char delta, direction; unsigned char errors; };
+        static const Transitions *TransitionTable(void);
+
+        /* The state below is split in blocks by who writes them, each block on
+           cache lines of its own. The leading padding also keeps them away
+           from whatever is allocated right before us, like another encoder */
+        static constexpr size_t cache_line = 64;
+        char _leading_padding[cache_line];
+
+        /* Writer side, only touched by the edge decoding while holding the lock,
+           the counter is never reset so the edge history stays continuous */
+        std::atomic_flag _decode_lock;
+        unsigned _prev_packed_read;
+        long _counter;
+        /* Counter value of the last edge event signal */
+        long _event_counter;
+#ifdef DEBUG
+        std::atomic<unsigned long long> _gpio_processing_error_count;
+#endif
+        toolbox::histogram _dispatch_latency;
+        char _writer_padding[cache_line];
+
+        /* Published side, a seqlock over the count, direction and time of the
+           last edge, so the control thread never sees them torn */
+        std::atomic<unsigned> _published_sequence;
+        std::atomic<long> _published_count;
+        std::atomic<int> _published_direction;
+        std::atomic<long long> _published_timestamp_ns;
+        char _published_padding[cache_line];
+
+        /* Reader side, zeroing moves this offset instead of the counter */
+        std::atomic<long> _zero_offset;
 
-        /* Internal state variables */
-        std::atomic<long> _counter;
-        std::chrono::nanoseconds _pulse_period_ns;
-        std::atomic<Direction> _direction;
-        
         /* If we are in 1x, 2x or 4x rates */
         const int _encoder_rate;
 
         /* How many counts are an actual revolution */
         int _segments_per_revolution;
 
-        /* Used to keep track of the actual interrupt pulse-widths */
-        std::atomic<char> _internal_toggle;
-        void TrackChannelPulseWidth(void);
+        /* Lock-free history of the recent edges, one entry per decoded run with
+           the counter value it left behind. Every slot carries its own sequence
+           number so readers can skip the ones being rewritten */
+        struct EdgeStamp {
+            std::atomic<unsigned long> sequence;
+            std::atomic<long long> timestamp_ns;
+            std::atomic<long> count;
+        };
+        static constexpr size_t edge_history = 512;
+        std::atomic<long long> _velocity_window_ns;
+        std::atomic<bool> _edge_scheduling_set;
+        int _edge_policy, _edge_priority, _edge_cpu;
+        size_t _edge_stack_prefault;
+        std::atomic<toolbox::wakeup_event *> _edge_event;
+        std::atomic<long> _edge_event_threshold;
+        char _settings_padding[cache_line];
+        std::atomic<unsigned long> _edges_head;
+        EdgeStamp _edges[edge_history];
+        char _edges_padding[cache_line];
 
-        std::chrono::high_resolution_clock::time_point _isr_timestamp;
+        void RecordEdges(const long long &timestamp_ns, const long &count);
+        bool ReadEdges(const unsigned long &index, long long &timestamp_ns, long &count);
+        bool ReadLatestEdges(unsigned long &index, long long &timestamp_ns, long &count);
+        void EstimateMotion(double &velocity, double &acceleration);
 
 #ifdef DEBUG
-        std::atomic<unsigned long long> _channel_a_isr_count, _channel_b_isr_count;
-        std::atomic<unsigned long long> _gpio_processing_error_count;
+        /* Each channel thread counts on its own line */
+        std::atomic<unsigned long long> _channel_a_isr_count;
+        char _channel_a_padding[cache_line];
+        std::atomic<unsigned long long> _channel_b_isr_count;
+        char _channel_b_padding[cache_line];
         void PrintDebugStats(void);
 #endif
 };
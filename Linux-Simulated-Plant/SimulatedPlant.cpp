@@ -0,0 +1,341 @@
+/* 
+ * The following userspace module replaces the PWM and GPIO sysfs
+ * abstractions with a simulated plant, so the control stack can be
+ * exercised and benchmarked on any Linux box without the hardware.
+ *
+ * Each joint is modeled as a permanent magnet DC motor with a linear
+ * torque/speed curve (stall torque and free running speed at 100% duty)
+ * driving a gearbox, with the load inertia reflected to the motor shaft,
+ * static friction (the minimum duty that produces movement, which is
+ * what RoboticArm::CalibrateMovement searches for), Coulomb and viscous
+ * friction. The output shaft angle is converted into quadrature A/B
+ * levels, and every level change is dispatched to the GPIO callbacks
+ * the same way the sysfs interrupt threads would do it.
+ *
+ * A single thread advances every plant in fixed sub-steps, releasing
+ * itself on absolute deadlines at config::sim_plant_rate_hz.
+ *
+ * References:
+ * http://ctms.engin.umich.edu/CTMS/index.php?example=MotorSpeed&section=SystemModeling
+ * https://www.pololu.com/product/1443
+ *
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <cmath>
+#include <chrono>
+#include "SimulatedPlant.h"
+#include "../toolbox.h"
+#include "../RoboticArm_Config.h"
+
+/* Longest time the model catches up with after the thread was held off */
+#define max_catch_up_seconds (double)10E-03
+
+
+namespace
+{
+    /* Gray code sequence of packed (B << 1 | A) levels for increasing counts */
+    const int quadrature_sequence[4] = { 0, 2, 3, 1 };
+
+    class Simulation
+    {
+        public:
+            explicit Simulation(void) : _stop_event(false) {}
+
+            ~Simulation(void)
+            {
+                if (SimulationThread.joinable()) {
+                    _stop_event = true;
+                    SimulationThread.join();
+                }
+            }
+
+            std::shared_ptr<SimulatedPlant> Get(const int &id)
+            {
+                std::lock_guard<std::mutex> lock(_plants_lock);
+
+                if (!_plants[id]) {
+                    _plants[id] = std::shared_ptr<SimulatedPlant>(new SimulatedPlant(id));
+                }
+                if (!SimulationThread.joinable()) {
+                    SimulationThread = std::thread(&Simulation::Run, this);
+                }
+                return _plants[id];
+            }
+
+        private:
+            std::mutex _plants_lock;
+            std::shared_ptr<SimulatedPlant> _plants[config::joints_nr];
+
+            std::thread SimulationThread;
+            std::atomic<bool> _stop_event;
+
+            void Run(void)
+            {
+                const double step = 1.0 / config::sim_plant_rate_hz;
+                toolbox::periodic_timer period(1E09 / config::sim_plant_rate_hz);
+                auto last = std::chrono::steady_clock::now();
+
+                while (!_stop_event) {
+
+                    /* Follow the wall clock, in sub-steps no longer than our period */
+                    const auto now = std::chrono::steady_clock::now();
+                    const double elapsed = std::min(std::chrono::duration<double>(now - last).count(),
+                                                    max_catch_up_seconds);
+                    const int substeps = std::max(1, (int)std::ceil(elapsed / step));
+                    last = now;
+
+                    {
+                        std::lock_guard<std::mutex> lock(_plants_lock);
+                        for (auto &plant : _plants) {
+                            if (!plant) continue;
+                            for (auto n = 0; n < substeps; n++) plant->Step(elapsed / substeps);
+                        }
+                    }
+
+                    period.wait();
+                }
+            }
+    };
+
+    Simulation &GetSimulation(void)
+    {
+        static Simulation simulation;
+        return simulation;
+    }
+}
+
+
+SimulatedPlant::SimulatedPlant(const int &id) :
+    _id(id),
+    _motor_angle(0),
+    _motor_velocity(0),
+    _output_angle(0),
+    _output_velocity(0),
+    _counts(0),
+    _packed_levels(quadrature_sequence[0])
+{
+    const auto *p = config::sim_plant_parameters[_id];
+
+    _gear_ratio = p[0];
+    _free_speed = p[1] * 2 * M_PI / 60.0;
+    _stall_torque = p[2];
+    /* Load inertia is seen through the gearbox by the motor shaft */
+    _inertia = p[3] + p[4] / (_gear_ratio * _gear_ratio);
+    _static_friction = p[5];
+    _coulomb_friction = p[6];
+    _viscous_friction = p[7];
+    _segments_per_revolution = config::quad_encoder_segments[_id];
+
+    for (auto channel = 0; channel < 2; channel++) {
+        _drive[channel] = 0;
+        _enabled[channel] = false;
+    }
+
+    logger << "I: Simulated plant created for joint " << _id
+           << " (" << _gear_ratio << ":1 gearbox, deadband ~"
+           << 100 * _static_friction / _stall_torque << "% duty)" << std::endl;
+}
+
+
+SimulatedPlant::~SimulatedPlant(void)
+{
+    return;
+}
+
+
+std::shared_ptr<SimulatedPlant> SimulatedPlant::GetByMotorPin(const int &pin, int &channel)
+{
+    for (auto id = 0; id < config::joints_nr; id++) {
+        for (channel = 0; channel < 2; channel++) {
+            if (config::dc_motor_pins[id][channel] == pin) return GetSimulation().Get(id);
+        }
+    }
+    throw std::runtime_error("No simulated plant is wired to PWM pin " + std::to_string(pin));
+}
+
+
+std::shared_ptr<SimulatedPlant> SimulatedPlant::GetByEncoderPin(const int &pin, int &channel)
+{
+    for (auto id = 0; id < config::joints_nr; id++) {
+        for (channel = 0; channel < 2; channel++) {
+            if (config::quad_encoder_pins[id][channel] == pin) return GetSimulation().Get(id);
+        }
+    }
+    throw std::runtime_error("No simulated plant is wired to GPIO pin " + std::to_string(pin));
+}
+
+
+void SimulatedPlant::SetDrive(const int &channel, const double &fraction, const bool &enabled)
+{
+    _drive[channel] = fraction;
+    _enabled[channel] = enabled;
+}
+
+
+bool SimulatedPlant::GetLevel(const int &channel)
+{
+    return (_packed_levels >> channel) & 1;
+}
+
+
+void SimulatedPlant::SetEdgeCallback(const int &channel, const std::function<void(bool)> &callback)
+{
+    std::lock_guard<std::mutex> lock(_callbacks_lock);
+    _edge_callbacks[channel] = callback;
+}
+
+
+double SimulatedPlant::GetAngle(void)
+{
+    return _output_angle;
+}
+
+
+double SimulatedPlant::GetVelocity(void)
+{
+    return _output_velocity;
+}
+
+
+void SimulatedPlant::Step(const double &dt)
+{
+    /* Signed duty seen by the motor, a disabled channel leaves it floating */
+    double u = 0;
+    if (_enabled[1]) u += _drive[1];
+    if (_enabled[0]) u -= _drive[0];
+
+    /* Linear torque/speed curve, back-EMF takes torque away with speed */
+    const double torque = _stall_torque * (u - _motor_velocity / _free_speed);
+
+    if ((_motor_velocity == 0) && (std::abs(torque) <= _static_friction)) {
+        /* Stiction holds the shaft still, this is our deadband */
+    } else {
+        const double direction = (_motor_velocity != 0) ? std::copysign(1.0, _motor_velocity)
+                                                        : std::copysign(1.0, torque);
+        const double friction = _coulomb_friction * direction + _viscous_friction * _motor_velocity;
+
+        double velocity = _motor_velocity + (torque - friction) / _inertia * dt;
+        /* Friction can bring the shaft to a stop, but never reverse it */
+        if (velocity * direction < 0) velocity = 0;
+
+        _motor_velocity = velocity;
+        _motor_angle += velocity * dt;
+    }
+
+    _output_angle = _motor_angle / _gear_ratio;
+    _output_velocity = _motor_velocity / _gear_ratio;
+
+    /* Walk every count in between, so no quadrature state is skipped */
+    const long target = std::floor(_output_angle / (2 * M_PI) * _segments_per_revolution);
+
+    while (_counts != target) {
+        _counts += (target > _counts) ? 1 : -1;
+
+        const int levels = quadrature_sequence[_counts & 3];
+        const int changed = levels ^ _packed_levels;
+        _packed_levels = levels;
+
+        std::lock_guard<std::mutex> lock(_callbacks_lock);
+        for (auto channel = 0; channel < 2; channel++) {
+            if ((changed >> channel) & 1 && _edge_callbacks[channel]) {
+                _edge_callbacks[channel]((levels >> channel) & 1);
+            }
+        }
+    }
+}
+
+
+PWM::PWM(const unsigned short &id) :
+    _period(0),
+    _duty(0),
+    _state(State::DISABLED)
+{
+    _plant = SimulatedPlant::GetByMotorPin(id, _channel);
+}
+
+
+PWM::~PWM(void)
+{
+    _plant->SetDrive(_channel, 0, false);
+}
+
+
+void PWM::setPeriod(const Period &period)
+{
+    _period = period;
+    Update();
+}
+
+
+PWM::Period PWM::getPeriod(void)
+{
+    return _period;
+}
+
+
+void PWM::setDuty(const Duty &duty)
+{
+    _duty = duty;
+    Update();
+}
+
+
+PWM::Duty PWM::getDuty(void)
+{
+    return _duty;
+}
+
+
+void PWM::setState(const State &state)
+{
+    _state = state;
+    Update();
+}
+
+
+PWM::State PWM::getState(void)
+{
+    return _state;
+}
+
+
+void PWM::Update(void)
+{
+    const double fraction = _period ? std::min(1.0, _duty / (double)_period) : 0;
+    _plant->SetDrive(_channel, fraction, _state == State::ENABLED);
+}
+
+
+GPIO::GPIO(const unsigned short &id, const Edge &edge, std::function<void(Value)> isr) :
+    _edge(edge),
+    _isr(isr)
+{
+    _plant = SimulatedPlant::GetByEncoderPin(id, _channel);
+
+    if (_isr && (_edge != Edge::NONE)) {
+        _plant->SetEdgeCallback(_channel, std::bind(&GPIO::Dispatch, this, std::placeholders::_1));
+    }
+}
+
+
+GPIO::~GPIO(void)
+{
+    /* Make sure the simulation thread is not going to call us anymore */
+    _plant->SetEdgeCallback(_channel, nullptr);
+}
+
+
+GPIO::Value GPIO::getValue(void)
+{
+    return _plant->GetLevel(_channel) ? Value::HIGH : Value::LOW;
+}
+
+
+void GPIO::Dispatch(bool level)
+{
+    /* Filter the edges the same way the sysfs edge setting would */
+    if ((_edge == Edge::RISING && !level) || (_edge == Edge::FALLING && level)) return;
+    _isr(level ? Value::HIGH : Value::LOW);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <string>
+
+/*
+ * Drop-in replacements for the HighLatencyPWM and HighLatencyGPIO classes,
+ * selected at build time with SIMULATED_PLANT. Instead of sysfs nodes they
+ * drive and sense a software model of a DC motor with its gearbox, so the
+ * rest of the stack (Motor, QuadratureEncoder, RoboticArm) runs unmodified.
+ */
+
+
+class SimulatedPlant
+{
+    public:
+        explicit SimulatedPlant(const int &id);
+        virtual ~SimulatedPlant(void);
+
+        /* Plants are shared by the PWM and GPIO objects of the same joint */
+        static std::shared_ptr<SimulatedPlant> GetByMotorPin(const int &pin, int &channel);
+        static std::shared_ptr<SimulatedPlant> GetByEncoderPin(const int &pin, int &channel);
+
+        /* H-Bridge inputs, channel 0 drives CW and channel 1 drives CCW */
+        void SetDrive(const int &channel, const double &fraction, const bool &enabled);
+
+        /* Quadrature outputs, channel 0 is A and channel 1 is B */
+        bool GetLevel(const int &channel);
+        void SetEdgeCallback(const int &channel, const std::function<void(bool)> &callback);
+
+        /* Model state, output shaft angle in radians and speed in rad/s */
+        double GetAngle(void);
+        double GetVelocity(void);
+
+        /* Advances the model by dt seconds, called by the simulation thread */
+        void Step(const double &dt);
+
+    private:
+        const int _id;
+
+        /* Physical parameters, motor side unless noted */
+        double _gear_ratio;
+        double _stall_torque, _free_speed;
+        double _inertia;
+        double _static_friction, _coulomb_friction, _viscous_friction;
+        long _segments_per_revolution;
+
+        /* Inputs from the two PWM channels */
+        std::atomic<double> _drive[2];
+        std::atomic<bool> _enabled[2];
+
+        /* Motor shaft state */
+        double _motor_angle, _motor_velocity;
+        std::atomic<double> _output_angle, _output_velocity;
+
+        /* Encoder state, counts and the A/B levels they produce */
+        long _counts;
+        std::atomic<int> _packed_levels;
+        std::mutex _callbacks_lock;
+        std::function<void(bool)> _edge_callbacks[2];
+};
+
+
+class PWM
+{
+    public:
+        typedef unsigned long Period;
+        typedef unsigned long Duty;
+        enum class State { DISABLED, ENABLED };
+
+        explicit PWM(const unsigned short &id);
+        virtual ~PWM(void);
+
+        void setPeriod(const Period &period);
+        Period getPeriod(void);
+        void setDuty(const Duty &duty);
+        Duty getDuty(void);
+        void setState(const State &state);
+        State getState(void);
+
+    private:
+        std::shared_ptr<SimulatedPlant> _plant;
+        int _channel;
+        Period _period;
+        Duty _duty;
+        State _state;
+
+        void Update(void);
+};
+
+
+class GPIO
+{
+    public:
+        enum class Value { LOW = 0, HIGH = 1 };
+        enum class Edge { NONE, RISING, FALLING, BOTH };
+
+        explicit GPIO(const unsigned short &id, const Edge &edge,
+                      std::function<void(Value)> isr = nullptr);
+        virtual ~GPIO(void);
+
+        Value getValue(void);
+
+    private:
+        std::shared_ptr<SimulatedPlant> _plant;
+        int _channel;
+        const Edge _edge;
+        std::function<void(Value)> _isr;
+
+        void Dispatch(bool level);
+};
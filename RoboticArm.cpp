@@ -24,90 +24,422 @@
 
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
 #include <cmath>
 #include <atomic>
 #include <chrono>
 #include <thread>
+#include <pthread.h>
 #include "toolbox.h"
 #include "RoboticArm.h"
 #include "RoboticArm_Config.h"
 
 
-RoboticJoint::RoboticJoint(const int &id) :
-    _id(id),
-    _reference_angle(0),
-    _control_thread_stop_event(false)
-{
+/* Sensors are created from the joint configuration, one per type */
+template<class Sensor> Sensor *CreateSensor(const int &id);
 
-#ifndef VISUAL_ENCODER
-
-    Position = std::shared_ptr<QuadratureEncoder>(
-                    new QuadratureEncoder(config::quad_encoder_pins[_id][0],
-                                          config::quad_encoder_pins[_id][1],
-                                          config::quad_encoder_rate));
+template<> QuadratureEncoder *CreateSensor<QuadratureEncoder>(const int &id)
+{
+    auto encoder = new QuadratureEncoder(config::quad_encoder_pins[id][0],
+                                         config::quad_encoder_pins[id][1],
+                                         config::quad_encoder_rate);
     /* Set the physical parameters for correct degree measurements
      * this is basically the number of segments per revolution   */
-    Position->SetParameters(config::quad_encoder_segments[_id]);
+    encoder->SetParameters(config::quad_encoder_segments[id]);
+    encoder->SetVelocityWindow(std::chrono::microseconds(config::quad_encoder_velocity_window_us[id]));
+    /* Its edge threads move themselves to their real-time settings */
+    const auto &scheduling = config::encoder_thread_scheduling[id];
+    encoder->SetThreadScheduling(scheduling.policy, scheduling.priority, scheduling.cpu,
+                                 config::thread_stack_prefault);
+    return encoder;
+}
 
-#else
 
-    Position = std::shared_ptr<VisualEncoder>(
-                        new VisualEncoder(config::visual_enc_port[_id]));
+/* Applies the configured scheduling to a control loop thread, a free running
+ * loop never sleeps so it stays time shared, or it would starve everything else */
+static void ScheduleControlThread(const std::string &name, const pthread_t &thread,
+                                  const config::ThreadScheduling &scheduling,
+                                  const bool &free_running)
+{
+    if (free_running && (scheduling.policy != SCHED_OTHER)) {
+        logger << "W: The " << name << " loop is free running, keeping it on SCHED_OTHER" << std::endl;
+        toolbox::set_thread_scheduling(name, thread, SCHED_OTHER, 0, scheduling.cpu);
+        return;
+    }
+    toolbox::set_thread_scheduling(name, thread, scheduling.policy, scheduling.priority, scheduling.cpu);
+}
+
 
+/* Encoders driven by edge interrupts keep their dispatch latencies, the others do not */
+template<class Sensor> inline toolbox::histogram *GetSensorDispatchLatency(Sensor &)
+{
+    return NULL;
+}
+
+inline toolbox::histogram *GetSensorDispatchLatency(QuadratureEncoder &sensor)
+{
+    return &sensor.GetDispatchLatency();
+}
+
+
+/* Encoders wake up event driven loops on their edges, the others only time out */
+template<class Sensor> inline void SetSensorEvent(Sensor &, toolbox::wakeup_event &, const long &)
+{
+    return;
+}
+
+inline void SetSensorEvent(QuadratureEncoder &sensor, toolbox::wakeup_event &event, const long &counts)
+{
+    sensor.SetEdgeEvent(&event, counts);
+}
+
+
+/* Sensors that time their own edges provide a velocity, the others do not */
+template<class Sensor> inline double GetSensorVelocity(Sensor &)
+{
+    return NAN;
+}
+
+inline double GetSensorVelocity(QuadratureEncoder &sensor)
+{
+    return sensor.GetVelocity();
+}
+
+/* Same for the actuators */
+template<class Actuator> Actuator *CreateActuator(const int &id);
+
+template<> Motor *CreateActuator<Motor>(const int &id)
+{
+    std::shared_ptr<PWMRegisters> registers;
+
+    /* The pins become channels of the register block */
+    if (config::dc_motor_drivers[id] == config::MotorDriver::MMIO) {
+        registers = std::shared_ptr<PWMRegisters>(new PWMRegisters(config::dc_motor_mmio_device,
+                                                                   config::dc_motor_mmio_offset));
+    }
+
+    auto motor = new Motor(config::dc_motor_pins[id][0],
+                           config::dc_motor_pins[id][1],
+                           registers);
+    /* Effort changes below this are not worth a PWM write */
+    motor->SetDeadband(config::dc_motor_deadband_percent[id]);
+    return motor;
+}
+
+#ifdef VISUAL_ENCODER
+template<> VisualEncoder *CreateSensor<VisualEncoder>(const int &id)
+{
+    return new VisualEncoder(config::visual_encoder_ports[id]);
+}
 #endif
-    /* H-Bridge 2 PWM pins motor abstraction */
-    Movement = std::shared_ptr<Motor>(
-                        new Motor(config::dc_motor_pins[_id][0],
-                                  config::dc_motor_pins[_id][1]));
-    
+
+
+RoboticJointBase::RoboticJointBase(const int &id) :
+    _id(id),
+    _reference_angle(0),
+    _reference_velocity(0),
+    _reference_acceleration(0),
+    _control_thread_stop_event(false),
+    _control_thread_running(false),
+    _missed_deadlines(0)
+{
+    /* PID with feed-forward angular control law */
+    const auto *k = config::pid_gains[_id];
+    PIDController::Gains gains = { k[0], k[1], k[2], k[3], k[4], k[5],
+                                   config::pid_integral_limits[_id],
+                                   config::pid_derivative_cutoff_hz[_id] };
+    Control = std::shared_ptr<AngularController>(new PIDController(gains));
 }
 
-RoboticJoint::~RoboticJoint(void)
+RoboticJointBase::~RoboticJointBase(void)
 {
-    Movement->Stop();
+    StopControl();
+}
 
+
+void RoboticJointBase::StopControl(void)
+{
     /* Stop the automatic control loop thread */
     if (AutomaticControlThread.joinable()) {
         _control_thread_stop_event = true;
+        /* No need to wait for an event driven loop to time out */
+        _wakeup.signal(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch()).count());
         AutomaticControlThread.join();
     }
 }
 
 
-void RoboticJoint::Init(void)
+void RoboticJointBase::Init(void)
 {
     logger << "I: Joint ID " << _id << " is in our home position" << std::endl;
-    /* Register our control thread */
-    AutomaticControlThread = std::thread(&RoboticJoint::AngularControl, this);
+
+    /* Start the control law from a clean state */
+    Control->Reset();
+    _last_control_time = std::chrono::steady_clock::now();
+
+    /* Register our control thread, unless the arm multiplexes all the joints */
+    if (!config::shared_control_thread) {
+        AutomaticControlThread = std::thread(&RoboticJointBase::AngularControl, this);
+        ScheduleControlThread("Joint ID " + std::to_string(_id) + " control",
+                              AutomaticControlThread.native_handle(),
+                              config::control_thread_scheduling[_id],
+                              (config::control_loop_rate_hz == 0) && !config::event_driven_control);
+    }
 
     /* Set the motors running, so the control loop can do real work on it */
-    Movement->Start();
+    StartMovement();
+
+    /* Its start up (first log line included) is over once we return */
+    while (AutomaticControlThread.joinable() && !_control_thread_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
 }
 
 
-double RoboticJoint::GetAngle(void)
+bool RoboticJointBase::SetAngle(const double &theta,
+                                const double &velocity,
+                                const double &acceleration)
 {
-    /* Keep in mind that we are reading from the raw sensor */
-    double angle = Position->GetAngle();
+    /* The control loop will take charge of getting us here eventually */
+    return QueueAngle(std::chrono::steady_clock::now(), theta, velocity, acceleration);
+}
+
+
+bool RoboticJointBase::QueueAngle(const std::chrono::steady_clock::time_point &time,
+                                  const double &theta,
+                                  const double &velocity,
+                                  const double &acceleration)
+{
+    Setpoint sp;
+
+    /* theta is in radians so converting from 0 to 360 */
+    double angle = theta * 180.0 / M_PI;
     /* Wrap it on 360 degrees */
     angle = std::fmod(angle, 360.0) + 360.0;
-    return std::fmod(angle, 360.0);
+
+    sp.time = time;
+    sp.angle = std::fmod(angle, 360.0);
+    /* Rates need no wrapping, they are only used for feed-forward */
+    sp.velocity = velocity * 180.0 / M_PI;
+    sp.acceleration = acceleration * 180.0 / M_PI;
+
+    /* The control loop consumes it once its time has come */
+    if (!_setpoints.push(sp)) return false;
+
+    /* An event driven loop works out from the queue how long it can sleep */
+    if (config::event_driven_control) {
+        _wakeup.signal(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+    return true;
 }
 
 
-void RoboticJoint::SetAngle(const double &theta)
+size_t RoboticJointBase::GetQueueSpace(void)
 {
-    /* Update the internal variable, the control loop
-     * will take charge of getting us here eventually 
-     * theta is in radians so converting from 0 to 360 */
-    double angle = theta * 180.0 / M_PI;
+    return _setpoints.space();
+}
+
+
+unsigned long long RoboticJointBase::GetMissedDeadlines(void)
+{
+    return _missed_deadlines;
+}
+
+
+toolbox::histogram &RoboticJointBase::GetLoopPeriods(void)
+{
+    return _loop_periods;
+}
+
+
+toolbox::histogram &RoboticJointBase::GetWakeupLatencies(void)
+{
+    return _wakeup_latencies;
+}
+
+
+toolbox::histogram &RoboticJointBase::GetComputeTimes(void)
+{
+    return _compute_times;
+}
+
+
+toolbox::histogram &RoboticJointBase::GetActuationTimes(void)
+{
+    return _actuation_times;
+}
+
+
+void RoboticJointBase::PrintLatencyStats(void)
+{
+    const std::string joint = "Joint ID " + std::to_string(_id);
+
+    toolbox::log_latency(joint + " wake-up latency", _wakeup_latencies);
+    toolbox::log_latency(joint + " compute time", _compute_times);
+    toolbox::log_latency(joint + " actuation time", _actuation_times);
+}
+
+
+double RoboticJointBase::GetCPUTime(void)
+{
+    /* Joints driven by the arm executor have no thread of their own */
+    if (!AutomaticControlThread.joinable()) return 0;
+    return toolbox::thread_cpu_time(AutomaticControlThread.native_handle());
+}
+
+
+void RoboticJointBase::SetTelemetry(const std::shared_ptr<TelemetrySegment> &telemetry)
+{
+    _telemetry = telemetry;
+}
+
+
+void RoboticJointBase::RecordTimes(const std::chrono::steady_clock::time_point &now,
+                                   const std::chrono::steady_clock::time_point &computed,
+                                   const std::chrono::steady_clock::time_point &actuated)
+{
+    _compute_times.record(std::chrono::duration_cast<std::chrono::nanoseconds>(computed - now).count());
+    _actuation_times.record(std::chrono::duration_cast<std::chrono::nanoseconds>(actuated - computed).count());
+}
+
+
+void RoboticJointBase::RecordTelemetry(const std::chrono::steady_clock::time_point &now,
+                                       const std::chrono::steady_clock::time_point &actuated,
+                                       const double &dt,
+                                       const double &measured,
+                                       const double &error,
+                                       const double &effort)
+{
+    if (!_telemetry) return;
+
+    TelemetryRecord record;
+    record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    record.reference = _reference_angle;
+    record.measured = measured;
+    record.error = error;
+    record.effort = effort;
+    /* The first iteration counts from Init, keep it within range */
+    record.period_ns = (uint32_t)std::min(dt * 1E09, (double)UINT32_MAX);
+    record.compute_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(actuated - now).count();
+    record.reserved = 0;
+
+    _telemetry->Push(_id, record);
+}
+
+
+double RoboticJointBase::UpdateReference(const std::chrono::steady_clock::time_point &now)
+{
+    /* Time elapsed since our last evaluation */
+    const auto period = now - _last_control_time;
+    _last_control_time = now;
+    _loop_periods.record(std::chrono::duration_cast<std::chrono::nanoseconds>(period).count());
+
+    /* Apply every setpoint that is due, the most recent one wins */
+    for(Setpoint *sp = _setpoints.front(); sp && (sp->time <= now); sp = _setpoints.front()) {
+        _reference_angle = sp->angle;
+        _reference_velocity = sp->velocity;
+        _reference_acceleration = sp->acceleration;
+        _setpoints.pop();
+    }
+
+    return std::chrono::duration<double>(period).count();
+}
+
+
+void RoboticJointBase::AngularControl(void)
+{
+    /* No page faults on the stack once the loop runs */
+    if (config::thread_stack_prefault) toolbox::prefault_stack(config::thread_stack_prefault);
+
+    logger << "I: Joint ID " << _id << " angular control is now active" << std::endl;
+    _control_thread_running = true;
+
+    /* Fixed-rate mode releases each iteration on an absolute deadline */
+    const bool fixed_rate = (config::control_loop_rate_hz > 0);
+    toolbox::periodic_timer period(fixed_rate ? (1E09 / config::control_loop_rate_hz) : 0);
+
+    /* Event driven mode only iterates when there is news, or on the max period */
+    const auto max_period = std::chrono::microseconds(config::event_max_period_us);
+
+    while(!_control_thread_stop_event) {
+
+        /* Anything signalled from here on means another iteration right away */
+        const uint32_t seen = _wakeup.sequence();
+
+        /* Each joint samples its own clock when running on its own thread */
+        const auto now = std::chrono::steady_clock::now();
+        AngularControlStep(now);
+
+        if (config::event_driven_control) {
+            /* Sleep until the encoder moves, the next reference is due or the max period */
+            std::chrono::nanoseconds timeout = max_period;
+            const Setpoint *next = _setpoints.front();
+            if (next) {
+                const auto due = std::chrono::duration_cast<std::chrono::nanoseconds>(next->time - now);
+                timeout = std::max(std::chrono::nanoseconds(0), std::min(timeout, due));
+            }
+
+            if (_wakeup.wait(seen, timeout.count())) {
+                /* From the edge or reference that woke us up */
+                const auto woken = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch()).count();
+                _wakeup_latencies.record(std::max(0LL, (long long)woken - _wakeup.signal_time()));
+            }
+        } else if (fixed_rate) {
+            /* Sleep until our next period, keeping count of any overruns */
+            if (!period.wait()) _missed_deadlines++;
+            _wakeup_latencies.record(period.latency());
+        } else {
+            /* Send this task to a low priority state for efficient multi-threading */
+            sched_yield();
+        }
+
+    }
+
+    logger << "I: Joint ID " << _id << " angular control is now deactivated" << std::endl;
+}
+
+
+template<class Sensor, class Actuator>
+RoboticJoint<Sensor, Actuator>::RoboticJoint(const int &id) :
+    RoboticJointBase(id),
+    Position(CreateSensor<Sensor>(id)),
+    /* H-Bridge 2 PWM pins motor abstraction */
+    Movement(CreateActuator<Actuator>(id))
+{
+    /* The control loop sleeps between sensor changes */
+    if (config::event_driven_control) {
+        SetSensorEvent(*Position, _wakeup, config::event_wake_counts[id]);
+    }
+}
+
+template<class Sensor, class Actuator>
+RoboticJoint<Sensor, Actuator>::~RoboticJoint(void)
+{
+    /* The loop must be gone before our sensor and actuator are */
+    StopControl();
+    Movement->Stop();
+
+    PrintLatencyStats();
+}
+
+
+template<class Sensor, class Actuator>
+double RoboticJoint<Sensor, Actuator>::GetAngle(void)
+{
+    /* Keep in mind that we are reading from the raw sensor */
+    double angle = Position->GetAngle();
     /* Wrap it on 360 degrees */
     angle = std::fmod(angle, 360.0) + 360.0;
-    _reference_angle = std::fmod(angle, 360.0);
+    return std::fmod(angle, 360.0);
 }
 
 
-void RoboticJoint::SetZero(void)
+template<class Sensor, class Actuator>
+void RoboticJoint<Sensor, Actuator>::SetZero(void)
 {
     /* This will reset the sensors internal references */
     Position->SetZero();
@@ -115,160 +447,344 @@ void RoboticJoint::SetZero(void)
 }
 
 
-void RoboticJoint::AngularControl(void)
+template<class Sensor, class Actuator>
+void RoboticJoint<Sensor, Actuator>::StartMovement(void)
 {
-    logger << "I: Joint ID " << _id << " angular control is now active" << std::endl;
+    Movement->Start();
+}
+
+
+template<class Sensor, class Actuator>
+void RoboticJoint<Sensor, Actuator>::Disable(void)
+{
+    Movement->Disabled();
+}
+
+
+template<class Sensor, class Actuator>
+void RoboticJoint<Sensor, Actuator>::PrintLatencyStats(void)
+{
+    RoboticJointBase::PrintLatencyStats();
+
+    const auto dispatch = GetSensorDispatchLatency(*Position);
+    if (dispatch) toolbox::log_latency("Joint ID " + std::to_string(_id) + " encoder dispatch", *dispatch);
+}
+
+
+template<class Sensor, class Actuator>
+void RoboticJoint<Sensor, Actuator>::AngularControlStep(const std::chrono::steady_clock::time_point &now)
+{
+    /* Time elapsed since our last evaluation, in seconds */
+    const double dt = UpdateReference(now);
+
+    /* Internal refernces are in degrees no conversion at all */
+    const auto actual_angle = GetAngle();
+
+    /* Extracts the shortest signed rotation, within [-180, 180] degrees */
+    const auto error_angle = std::remainder(_reference_angle - actual_angle, 360.0);
+
+    /* Consists of the interaction between position & movement */
+    const auto effort = Control->Update(error_angle, actual_angle, dt,
+                                        _reference_velocity,
+                                        _reference_acceleration,
+                                        GetSensorVelocity(*Position));
+    const auto computed = std::chrono::steady_clock::now();
+
+    /* The sign of the effort indicates direction */
+    if (effort >= 0)
+        Movement->SetDirection(Actuator::Direction::CCW);
+    else
+        Movement->SetDirection(Actuator::Direction::CW);
+
+    /* Store the motor control value */
+    Movement->SetSpeed(std::abs(effort));
+    const auto actuated = std::chrono::steady_clock::now();
+
+    RecordTimes(now, computed, actuated);
+    RecordTelemetry(now, actuated, dt, actual_angle, error_angle, effort);
 
-    while(!_control_thread_stop_event) {
-        
-        /* Consists of the interaction between position & movement */
-        const auto k = 0.80;
-        /* Internal refernces are in degrees no conversion at all */
-        const auto actual_angle = GetAngle();
-
-        /* Extracts the shortest angle differences */
-        const auto e0 = std::remainder(actual_angle - _reference_angle, 180.0);
-        const auto e1 = std::remainder(_reference_angle - actual_angle, 180.0);
-        /* Picks the smallest rotation */
-        const auto error_angle = (e0 < e1) ? e0 : e1;
-
-        /* The angle that was choosen indicates direction */
-        if (error_angle == e0)
-            Movement->SetDirection(Motor::Direction::CCW);
-        else
-            Movement->SetDirection(Motor::Direction::CW);
-
-        /* P-Only control: Store the motor control value */
-        Movement->SetSpeed( k * std::abs(error_angle) + 4.0);
-        
 #if (DEBUG_LEVEL >= 10)
-        logger << "D: Joint ID " << _id << " actual=" << actual_angle << std::endl;
-        logger << "D: Joint ID " << _id << " reference=" << _reference_angle << std::endl;
-        logger << "D: Joint ID " << _id << " error=" << error_angle << std::endl;
-        logger << "D: Joint ID " << _id << " measured speed=" << Movement->GetSpeed() << "%" << std::endl;
-        logger << std::endl;
+    logger << log_literal("D: Joint ID ") << _id << log_literal(" actual=") << actual_angle << std::endl;
+    logger << log_literal("D: Joint ID ") << _id << log_literal(" reference=") << _reference_angle << std::endl;
+    logger << log_literal("D: Joint ID ") << _id << log_literal(" error=") << error_angle << std::endl;
+    logger << log_literal("D: Joint ID ") << _id << log_literal(" effort=") << effort << log_literal("%") << std::endl;
+    logger << log_literal("D: Joint ID ") << _id << log_literal(" measured speed=") << Movement->GetSpeed() << log_literal("%") << std::endl;
+    logger << std::endl;
 #endif
+}
+
+
+template<class Sensor, class Actuator>
+void RoboticJoint<Sensor, Actuator>::CalibrateMovement(void)
+{
+    double difference;
+    const double delta = 0.02;
+
+    /* Calibrate each motor independently to find the minimum speed
+     * value that produces real movement, due to rounding aritmethic
+     * errors we use an epsilon comparision in order to see if the
+     * value difference is more than that
+     */
+    double min_speed = 0;
+    Movement->SetDirection(Actuator::Direction::CCW);
+
+    /* Coarse tuning, aproximate where the threshold movement is */
+    do {
+        min_speed += delta;
+
+        /* Make sure we have not reached 100% */
+        if((int)min_speed == 100) {
+            logger << "E: Joint ID " << _id << " is unable to move or detect movement!" << std::endl;
+            exit(-99);
+        }
         
-        /* Send this task to a low priority state for efficient multi-threading */
-        sched_yield();
+        Movement->SetSpeed(min_speed);
+        auto old = GetAngle();
+        Movement->Start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        Movement->Stop();
+        difference = std::abs(GetAngle() - old);
         
-    }
+    } while(difference < epsilon);
+    
+    Movement->SetDirection(Actuator::Direction::CW);
+    /* Fine tuning, go back by delta squared to where we stop moving in steady state */
+    do {
 
-    logger << "I: Joint ID " << _id << " angular control is now deactivated" << std::endl;
+        /* Make sure we have not reached 0% + delta */
+        if((delta + epsilon) > min_speed) {
+            logger << "E: Joint ID " << _id << " is unable to stop at 0%!" << std::endl;
+            exit(-100);
+        }
+
+        min_speed -= (delta * delta);
+        Movement->SetSpeed(min_speed);
+        auto old = GetAngle();
+        Movement->Start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        Movement->Stop();
+        difference = std::abs(GetAngle() - old);
+        
+    } while(difference < epsilon);
+    
+    logger << "I: Joint ID " << _id << " min speed found for movement is ~" << min_speed << "%" << std::endl;
+    logger << "I: Joint ID " << _id << " set speed remap for 0% to 100% values" << std::endl;
+    
+    /* Now we can have a range from minimum speed to full */
+    Movement->ApplyRangeLimits(min_speed, 100);
+}
+
+
+template<class Sensor, class Actuator>
+void RoboticJoint<Sensor, Actuator>::CalibratePosition(void)
+{
+    double difference;
+
+    /* Get the rotors to a known position on a tight controlled loop 
+     * due to rounding aritmethic errors, we use an epsilon comparision
+     * in order to see if the values difference is less than it
+     */
+    Movement->SetDirection(Actuator::Direction::CW);
+    Movement->SetSpeed(100);
+    do {
+        
+        auto old = GetAngle();
+        Movement->Start();
+        /* Must account for turn off and turn on delays, use bigger delay */
+        std::this_thread::sleep_for(std::chrono::nanoseconds(1));
+        Movement->Stop();
+        difference = std::abs(GetAngle() - old);
+        
+    } while(difference >= epsilon);
+
+    /* Reset the position coordinates, this is our new home position */
+    SetZero();
 }
 
 
-RoboticArm::RoboticArm(void) : _joints_nr(config::joints_nr)
+/* Sensor and actuator combinations available to the arm factory */
+template class RoboticJoint<QuadratureEncoder, Motor>;
+#ifdef VISUAL_ENCODER
+template class RoboticJoint<VisualEncoder, Motor>;
+#endif
+
+
+/* Every joint needs its row in the DH table */
+static_assert(sizeof(config::dh_parameters) / sizeof(config::dh_parameters[0]) == config::joints_nr,
+              "config::dh_parameters needs one row per joint");
+
+/* And the scheduling of its threads */
+static_assert(sizeof(config::control_thread_scheduling) / sizeof(config::control_thread_scheduling[0]) == config::joints_nr,
+              "config::control_thread_scheduling needs one entry per joint");
+static_assert(sizeof(config::encoder_thread_scheduling) / sizeof(config::encoder_thread_scheduling[0]) == config::joints_nr,
+              "config::encoder_thread_scheduling needs one entry per joint");
+static_assert(sizeof(config::event_wake_counts) / sizeof(config::event_wake_counts[0]) == config::joints_nr,
+              "config::event_wake_counts needs one entry per joint");
+
+
+RoboticArm::RoboticArm(void) :
+    _joints_nr(config::joints_nr),
+    _chain(config::dh_parameters),
+    _analytic_ik(false),
+    _executor_stop_event(false),
+    _executor_running(false),
+    _executor_missed_deadlines(0)
 {
-    /* Initialize each joint objects with unique ID's */
+    /* Before any of our threads exist, so their stacks get locked as well */
+    if (config::lock_memory) {
+        const long locked = toolbox::lock_memory();
+        if (locked < 0) {
+            logger << "W: Unable to lock the memory in RAM, " << std::strerror(-locked) << std::endl;
+        } else if (locked == 0) {
+            logger << "W: The memory lock was accepted, yet the kernel reports no locked memory" << std::endl;
+        } else {
+            logger << "I: " << locked << " kB of memory locked in RAM" << std::endl;
+        }
+    }
+
+    /* Initialize each joint objects with unique ID's and their own sensor */
     for(auto id = 0; id < _joints_nr; id++) {
-        joints.push_back(std::shared_ptr<RoboticJoint>(new RoboticJoint(id)));
+        switch(config::joint_sensors[id])
+        {
+            case config::JointSensor::VISUAL:
+#ifdef VISUAL_ENCODER
+                joints.push_back(std::shared_ptr<RoboticJointBase>(
+                                    new RoboticJoint<VisualEncoder, Motor>(id)));
+                break;
+#else
+                logger << "E: Joint ID " << id << " needs a build with VISUAL_ENCODER" << std::endl;
+                exit(-126);
+#endif
+            case config::JointSensor::QUADRATURE:
+            default:
+                joints.push_back(std::shared_ptr<RoboticJointBase>(
+                                    new RoboticJoint<QuadratureEncoder, Motor>(id)));
+                break;
+        }
     }
+    /* Per iteration records of the loops, read with robot-arm-telemetry.app */
+    if (config::telemetry_shm_name[0] != '\0') {
+        try {
+            _telemetry = std::shared_ptr<TelemetrySegment>(new TelemetrySegment(config::telemetry_shm_name,
+                                                                                _joints_nr,
+                                                                                config::telemetry_depth,
+                                                                                config::control_loop_rate_hz));
+            for(auto &joint : joints) joint->SetTelemetry(_telemetry);
+            logger << "I: Control loop telemetry is in shared memory at " << config::telemetry_shm_name << std::endl;
+        } catch(const std::runtime_error &e) {
+            logger << "W: Running without telemetry, " << e.what() << std::endl;
+        }
+    }
+
+    /* Closed form inverse kinematics only holds for RR arms moving on the xy plane */
+    _analytic_ik = _chain.Analytic();
+
     logger << "I: Created a " << _joints_nr << " joints arm object" << std::endl;
 }
 
 
 RoboticArm::~RoboticArm(void)
 {
-    return;
+    /* Stop the shared control executor before the joints go away */
+    if (ControlExecutorThread.joinable()) {
+        _executor_stop_event = true;
+        ControlExecutorThread.join();
+        toolbox::log_latency("Control executor wake-up latency", _executor_wakeup_latencies);
+    }
 }
 
 
-void RoboticArm::CalibrateMovement(void)
+unsigned long long RoboticArm::GetMissedDeadlines(void)
 {
-    double difference;
-    const double delta = 0.02;
+    return _executor_missed_deadlines;
+}
 
-    /* Perform the initialization for each of the joints */
-    for(auto id = 0; id < _joints_nr; id++) {
 
-        auto const joint = joints[id];
+double RoboticArm::GetCPUTime(void)
+{
+    if (!ControlExecutorThread.joinable()) return 0;
+    return toolbox::thread_cpu_time(ControlExecutorThread.native_handle());
+}
 
-        /* Calibrate each motor independently to find the minimum speed
-         * value that produces real movement, due to rounding aritmethic
-         * errors we use an epsilon comparision in order to see if the
-         * value difference is more than that
-         */
-        double min_speed = 0;
-        joint->Movement->SetDirection(Motor::Direction::CCW);
-
-        /* Coarse tuning, aproximate where the threshold movement is */
-        do {
-            min_speed += delta;
-
-            /* Make sure we have not reached 100% */
-            if((int)min_speed == 100) {
-                logger << "E: Joint ID " << id << " is unable to move or detect movement!" << std::endl;
-                exit(-99);
-            }
-            
-            joint->Movement->SetSpeed(min_speed);
-            auto old = joint->GetAngle();
-            joint->Movement->Start();
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            joint->Movement->Stop();
-            difference = std::abs(joint->GetAngle() - old);
-            
-        } while(difference < epsilon);
-        
-        joint->Movement->SetDirection(Motor::Direction::CW);
-        /* Fine tuning, go back by delta squared to where we stop moving in steady state */
-        do {
-
-            /* Make sure we have not reached 0% + delta */
-            if((delta + epsilon) > min_speed) {
-                logger << "E: Joint ID " << id << " is unable to stop at 0%!" << std::endl;
-                exit(-100);
-            }
 
-            min_speed -= (delta * delta);
-            joint->Movement->SetSpeed(min_speed);
-            auto old = joint->GetAngle();
-            joint->Movement->Start();
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            joint->Movement->Stop();
-            difference = std::abs(joint->GetAngle() - old);
-            
-        } while(difference < epsilon);
-        
-        logger << "I: Joint ID " << id << " min speed found for movement is ~" << min_speed << "%" << std::endl;
-        logger << "I: Joint ID " << id << " set speed remap for 0% to 100% values" << std::endl;
-        
-        /* Now we can have a range from minimum speed to full */
-        joint->Movement->ApplyRangeLimits(min_speed, 100);
+toolbox::histogram &RoboticArm::GetWakeupLatencies(void)
+{
+    return _executor_wakeup_latencies;
+}
+
+
+std::shared_ptr<RoboticJointBase> RoboticArm::GetJoint(const int &id)
+{
+    return joints.at(id);
+}
+
+
+void RoboticArm::ControlExecutor(void)
+{
+    if (config::thread_stack_prefault) toolbox::prefault_stack(config::thread_stack_prefault);
+
+    logger << "I: Shared control executor is now active for " << _joints_nr << " joints" << std::endl;
+    _executor_running = true;
+
+    /* Fixed-rate mode releases each tick on an absolute deadline */
+    const bool fixed_rate = (config::control_loop_rate_hz > 0);
+    toolbox::periodic_timer period(fixed_rate ? (1E09 / config::control_loop_rate_hz) : 0);
+
+    while(!_executor_stop_event) {
+
+        /* Every joint is evaluated against the same sampling instant */
+        const auto now = std::chrono::steady_clock::now();
+
+        for(auto id = 0; id < _joints_nr; id++) {
+            joints[id]->AngularControlStep(now);
+        }
+
+        if (fixed_rate) {
+            /* Sleep until our next tick, keeping count of any overruns */
+            if (!period.wait()) _executor_missed_deadlines++;
+            _executor_wakeup_latencies.record(period.latency());
+        } else {
+            /* Send this task to a low priority state for efficient multi-threading */
+            sched_yield();
+        }
+
     }
+
+    logger << "I: Shared control executor is now deactivated" << std::endl;
 }
 
 
-void RoboticArm::CalibratePosition(void)
+void RoboticArm::StartControlExecutor(void)
 {
-    double difference;
+    if (config::event_driven_control) {
+        logger << "W: Event driven control needs a thread per joint, the executor runs at a fixed rate" << std::endl;
+    }
 
-    /* Perform the initialization for each of the joints */
+    ControlExecutorThread = std::thread(&RoboticArm::ControlExecutor, this);
+
+    /* Pinned so it does not bounce between our cores */
+    ScheduleControlThread("control executor", ControlExecutorThread.native_handle(),
+                          config::shared_control_scheduling, config::control_loop_rate_hz == 0);
+
+    /* Same as the joints, Init returns with the executor up and running */
+    while (!_executor_running) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+
+void RoboticArm::CalibrateMovement(void)
+{
+    /* Each joint finds the minimum speed that produces real movement */
     for(auto id = 0; id < _joints_nr; id++) {
+        joints[id]->CalibrateMovement();
+    }
+}
 
-        auto const joint = joints[id];
-       
-        /* Get the rotors to a known position on a tight controlled loop 
-         * due to rounding aritmethic errors, we use an epsilon comparision
-         * in order to see if the values difference is less than it
-         */
-        joint->Movement->SetDirection(Motor::Direction::CW);
-        joint->Movement->SetSpeed(100);
-        do {
-            
-            auto old = joint->GetAngle();
-            joint->Movement->Start();
-            /* Must account for turn off and turn on delays, use bigger delay */
-            std::this_thread::sleep_for(std::chrono::nanoseconds(1));
-            joint->Movement->Stop();
-            difference = std::abs(joint->GetAngle() - old);
-            
-        } while(difference >= epsilon);
-
-        /* Reset the position coordinates, this is our new home position */
-        joint->SetZero();
-        
+
+void RoboticArm::CalibratePosition(void)
+{
+    /* Each joint is driven to its mechanical limit, our home position */
+    for(auto id = 0; id < _joints_nr; id++) {
+        joints[id]->CalibratePosition();
     }
 }
 
@@ -289,6 +805,11 @@ void RoboticArm::Init(void)
 
     }
 
+    /* A single thread runs the control law of all the joints */
+    if (config::shared_control_thread) {
+        StartControlExecutor();
+    }
+
     logger << "I: Robot was successfully initialized" << std::endl;
 }
 
@@ -301,7 +822,7 @@ void RoboticArm::EnableTrainingMode(void)
         auto const joint = joints[id];
         
         /* Kill off the movement */
-        joint->Movement->Disabled();
+        joint->Disable();
 
     }
 
@@ -311,38 +832,73 @@ void RoboticArm::EnableTrainingMode(void)
 
 void RoboticArm::GetPosition(Point &pos)
 {
-    /* Temporary working matrix to fill sensor data */
-    std::vector<double> theta;
-    
+    /* Temporary working matrix to fill sensor data, on the stack */
+    JointVector theta;
+
     /* Fill our N joints angles in radians */
-    for(auto id = 0; id < _joints_nr; id++) {
-        theta.push_back( joints[id]->GetAngle() / 180.0 * M_PI );
-    }
+    GetAngles(theta);
 
     /* Makes use of forward kinematics in order to get position */
     ForwardKinematics(pos, theta);
 }
 
 
+void RoboticArm::GetAngles(JointVector &theta)
+{
+    /* Fill our N joints angles in radians */
+    for(auto id = 0; id < _joints_nr; id++) {
+        theta[id] = joints[id]->GetAngle() / 180.0 * M_PI;
+    }
+}
+
+
 void RoboticArm::SetPosition(const Point &pos)
 {
-    /* Temporary working matrix to store our reference angles */
-    std::vector<double> theta(_joints_nr);
+    /* Becomes the active reference on the next control tick */
+    if (!QueuePosition(pos, std::chrono::steady_clock::now())) {
+        logger << "W: Joints setpoint queues are full, dropping target position" << std::endl;
+    }
+}
 
-    /* Makes use of inverse kinematics in order to set position */
+
+bool RoboticArm::QueuePosition(const Point &pos, const std::chrono::steady_clock::time_point &time)
+{
+    /* Temporary working matrix to store our reference angles, on the stack */
+    JointVector theta;
+
+    /* Makes use of inverse kinematics in order to set position, starting
+     * the search from where the joints are right now */
+    GetAngles(theta);
     InverseKinematics(pos, theta);
-    
-    /* Update each of the joints their new reference angle */
+
+    return QueueAngles(time, theta);
+}
+
+
+bool RoboticArm::QueueAngles(const std::chrono::steady_clock::time_point &time,
+                             const JointVector &theta,
+                             const JointVector &velocity,
+                             const JointVector &acceleration)
+{
+    /* All or none of the joints get the new reference, so it is never torn */
+    for(auto id = 0; id < _joints_nr; id++) {
+        if (joints[id]->GetQueueSpace() == 0) return false;
+    }
+
+    /* Update each of the joints their new reference angle, all of them
+     * switch to it at the same instant since they share the timestamp */
     for(auto id = 0; id < _joints_nr; id++) {
-        joints[id]->SetAngle(theta[id]);
+        joints[id]->QueueAngle(time, theta[id], velocity[id], acceleration[id]);
     }
+
+    return true;
 }
 
 
 void RoboticArm::SetPositionSync(const Point &pos)
 {
     /* Synchronous version of SetPosition */
-    Point measured, target = pos;
+    Point measured = Point(), target = pos;
 
     SetPosition(target);
 
@@ -353,32 +909,19 @@ void RoboticArm::SetPositionSync(const Point &pos)
 }
 
 
-void RoboticArm::ForwardKinematics(Point &pos, const std::vector<double> &theta)
+void RoboticArm::ForwardKinematics(Point &pos, const JointVector &theta)
 {
+    /* End effector pose, the position is its last column */
+    kinematics::Transform pose;
+
+    ForwardKinematics(pose, theta);
+
     /* Temporary coordinate variable, to check for unsolvable solutions */
     Point tpos;
 
-    /* Length of the links in meters, read only */
-    const auto *L = &config::link_lengths[0];
-
-    switch(theta.size())
-    {
-        case 1:
-            tpos.x = L[0] * std::cos(theta[0]);
-            tpos.y = L[0] * std::sin(theta[0]);
-            tpos.z = 0;
-            break;
-        case 2:
-            tpos.x = L[0] * std::cos(theta[0]) + L[1] * std::cos(theta[0] + theta[1]);
-            tpos.y = L[0] * std::sin(theta[0]) + L[1] * std::sin(theta[0] + theta[1]);
-            tpos.z = 0;
-            break;
-        default:
-            /* oxavelar: To extend this to 3 dimensions for N joints */
-            logger << "E: Unable to calculate for more than 2 joints for now..." << std::endl;
-            exit(-127);
-            break;
-    }
+    tpos.x = pose(0, 3);
+    tpos.y = pose(1, 3);
+    tpos.z = pose(2, 3);
 
     /* Only update the target position if a solution in the 3D space was found */
     if (std::isnan(tpos.x) or std::isnan(tpos.y) or std::isnan(tpos.z)) {
@@ -389,38 +932,48 @@ void RoboticArm::ForwardKinematics(Point &pos, const std::vector<double> &theta)
 }
 
 
-void RoboticArm::InverseKinematics(const Point &pos, std::vector<double> &theta)
+void RoboticArm::ForwardKinematics(kinematics::Transform &pose, const JointVector &theta)
 {
-    /* Length of the links in meters, read only */
-    const auto *L = &config::link_lengths[0];
+    pose = _chain.Forward(theta);
+}
 
+
+double RoboticArm::InverseKinematics(const Point &pos, JointVector &theta)
+{
     /* Backup our angles */
-    const std::vector<double> theta_backup = theta;
-
-    switch(theta.size())
-    {
-
-        case 1:
-            theta[0] = std::atan2(pos.y, pos.x);
-        case 2:
-            #define D ((pos.x*pos.x + pos.y*pos.y - L[0]*L[0] - L[1]*L[1]) / (2 * L[0] * L[1]))
-            theta[1] = std::atan2( 1 - (D*D), D);
-            theta[0] = std::atan2(pos.y, pos.x) - std::atan2( (L[1] * std::sin(theta[1])), (L[0] + L[1] * std::cos(theta[1])) );
-            break;
-        default:
-            /* oxavelar: To extend this to 3 dimensions for N joints */
-            logger << "E: Unable to calculate for more than 2 joints for now..." << std::endl;
-            exit(-127);
-            break;
-    }
+    const JointVector theta_backup = theta;
 
-    /* Verify that each solved angle is a valid number before setting things up, abort and log */
-    for(auto id = 0; id < _joints_nr; id++) {
-        if(std::isnan(theta[id])) {
-            logger << "E: Desired target position is not achievable by this robot" << std::endl;
-            theta = theta_backup;
-            break;
-        }
+    const kinematics::Chain<config::joints_nr>::Position target = {{{ pos.x }, { pos.y }, { pos.z }}};
+
+    /* Closed form when the chain has one, damped least squares from where the
+     * joints are otherwise, either way the residual is the distance left */
+    const double residual = _analytic_ik ? _chain.InverseAnalytic(target, theta).residual :
+                            _chain.Inverse(target, theta, config::ik_max_iterations,
+                                           config::ik_damping, config::ik_tolerance).residual;
+
+    /* The closest the chain can get is still not the requested position, abort and log */
+    if (std::isnan(residual) || (residual > tolerance)) {
+        logger << "E: Desired target position is not achievable by this robot" << std::endl;
+        theta = theta_backup;
     }
+
+    return residual;
+}
+
+
+void RoboticArm::ForwardKinematicsBatch(const double *const *theta, const size_t &count,
+                                        double *x, double *y, double *z)
+{
+    _chain.ForwardBatch(theta, count, x, y, z);
 }
 
+
+size_t RoboticArm::InverseKinematicsBatch(const double *x, const double *y, const double *z,
+                                          const size_t &count, double *const *theta)
+{
+    return _chain.InverseBatch(x, y, z, count, theta,
+                               config::ik_max_iterations,
+                               config::ik_damping,
+                               config::ik_tolerance,
+                               tolerance);
+}
@@ -1,8 +1,18 @@
 #pragma once
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include "toolbox.h"
+#include "RoboticArm_Config.h"
+#include "Controller.h"
+#include "Kinematics.h"
+#include "Telemetry.h"
 #include "Linux-DC-Motor/Motor.h"
 #include "Linux-Quadrature-Encoder/QuadratureEncoder.h"
+#ifdef VISUAL_ENCODER
 #include "Linux-Visual-Encoder/VisualEncoder.h"
+#endif
 
 #define epsilon (double)1E-09
 
@@ -23,29 +33,145 @@ class Point
 };
 
 
-class RoboticJoint
+/* One value per joint of the arm, angles in radians or their rates, fixed
+ * size so passing them around the control path never touches the heap */
+typedef std::array<double, config::joints_nr> JointVector;
+
+
+class Setpoint
 {
     public:
-        explicit RoboticJoint(const int &id);
-        virtual ~RoboticJoint(void);
+        /* Instant at which the reference becomes active */
+        std::chrono::steady_clock::time_point time;
+        /* Degrees, degrees/s and degrees/s^2 */
+        double angle, velocity, acceleration;
+};
 
-        void Init(void);
-        double GetAngle(void);
-        void SetAngle(const double &theta);
-        void SetZero(void);
 
-        /* Quadrature encoders + DC motors */
-        std::shared_ptr<QuadratureEncoder> Position;
-        std::shared_ptr<Motor> Movement;
+class RoboticJointBase
+{
+    public:
+        explicit RoboticJointBase(const int &id);
+        virtual ~RoboticJointBase(void);
 
-    private:
+        void Init(void);
+        virtual double GetAngle(void) = 0;
+        bool SetAngle(const double &theta,
+                      const double &velocity = 0,
+                      const double &acceleration = 0);
+        bool QueueAngle(const std::chrono::steady_clock::time_point &time,
+                        const double &theta,
+                        const double &velocity = 0,
+                        const double &acceleration = 0);
+        size_t GetQueueSpace(void);
+        virtual void SetZero(void) = 0;
+        unsigned long long GetMissedDeadlines(void);
+
+        /* Every control iteration gets recorded into the segment, set it before Init */
+        void SetTelemetry(const std::shared_ptr<TelemetrySegment> &telemetry);
+
+        /* Control loop statistics, periods in nanoseconds and CPU time in seconds */
+        toolbox::histogram &GetLoopPeriods(void);
+        double GetCPUTime(void);
+
+        /* Latencies of the loop in nanoseconds: how late it woke up past its release
+         * time, from the sampling instant until the effort was computed, and how
+         * long writing it to the actuator took. Also dumped when the joint goes away */
+        toolbox::histogram &GetWakeupLatencies(void);
+        toolbox::histogram &GetComputeTimes(void);
+        toolbox::histogram &GetActuationTimes(void);
+        virtual void PrintLatencyStats(void);
+
+        /* Evaluates the control law once, also used by the arm executor */
+        virtual void AngularControlStep(const std::chrono::steady_clock::time_point &now) = 0;
+
+        /* Open loop procedures that drive the actuator directly */
+        virtual void CalibrateMovement(void) = 0;
+        virtual void CalibratePosition(void) = 0;
+        virtual void Disable(void) = 0;
+
+        /* Control law between the sensor and the actuator, replace it before Init */
+        std::shared_ptr<AngularController> Control;
+
+    protected:
         const int _id;
         std::atomic<double> _reference_angle;
+        /* Reference rates in degrees/s and degrees/s^2, for feed-forward */
+        std::atomic<double> _reference_velocity;
+        std::atomic<double> _reference_acceleration;
+        std::chrono::steady_clock::time_point _last_control_time;
+
+        /* Event driven loops sleep on it, signalled by the sensor and new references */
+        toolbox::wakeup_event _wakeup;
+
+        /* Accounts for the elapsed period and applies the due setpoints,
+         * returns the time since the previous evaluation in seconds */
+        double UpdateReference(const std::chrono::steady_clock::time_point &now);
+
+        /* Accounts for the compute and actuation times of the iteration sampled at now */
+        void RecordTimes(const std::chrono::steady_clock::time_point &now,
+                         const std::chrono::steady_clock::time_point &computed,
+                         const std::chrono::steady_clock::time_point &actuated);
+
+        /* Publishes what the iteration sampled at now did, never blocks */
+        void RecordTelemetry(const std::chrono::steady_clock::time_point &now,
+                             const std::chrono::steady_clock::time_point &actuated,
+                             const double &dt,
+                             const double &measured,
+                             const double &error,
+                             const double &effort);
+
+        /* Derived joints own the hardware, so they stop the loop before it goes away */
+        virtual void StartMovement(void) = 0;
+        void StopControl(void);
+
+    private:
+        /* Timestamped references, consumed by the control loop on its tick */
+        toolbox::spsc_queue<Setpoint, config::setpoint_queue_depth> _setpoints;
 
         /* Per joint position correction control */
         void AngularControl(void);
         std::thread AutomaticControlThread;
         std::atomic<bool> _control_thread_stop_event;
+        std::atomic<bool> _control_thread_running;
+        /* Control iterations that overran their fixed-rate period */
+        std::atomic<unsigned long long> _missed_deadlines;
+        toolbox::histogram _loop_periods;
+        toolbox::histogram _wakeup_latencies;
+        toolbox::histogram _compute_times;
+        toolbox::histogram _actuation_times;
+        std::shared_ptr<TelemetrySegment> _telemetry;
+};
+
+
+/*
+ * A joint made of a concrete position sensor and actuator, resolved at compile
+ * time so the control loop calls into them without any indirect dispatch.
+ *
+ * Sensor:   double GetAngle(void) in degrees, void SetZero(void)
+ * Actuator: Start, Stop, Disabled, SetSpeed, GetSpeed, ApplyRangeLimits and
+ *           SetDirection taking an Actuator::Direction::{CCW, CW}
+ */
+template<class Sensor, class Actuator>
+class RoboticJoint final : public RoboticJointBase
+{
+    public:
+        explicit RoboticJoint(const int &id);
+        virtual ~RoboticJoint(void);
+
+        double GetAngle(void) override;
+        void SetZero(void) override;
+        void AngularControlStep(const std::chrono::steady_clock::time_point &now) override;
+        void CalibrateMovement(void) override;
+        void CalibratePosition(void) override;
+        void Disable(void) override;
+        void PrintLatencyStats(void) override;
+
+        const std::unique_ptr<Sensor> Position;
+        const std::unique_ptr<Actuator> Movement;
+
+    protected:
+        void StartMovement(void) override;
 };
 
 
@@ -57,13 +183,38 @@ class RoboticArm
 
         void Init(void);
         void GetPosition(Point &pos);
+        void GetAngles(JointVector &theta);
         void SetPosition(const Point &pos);
         void SetPositionSync(const Point &pos);
-
-        void ForwardKinematics(Point &pos, const std::vector<double> &theta);
-        void InverseKinematics(const Point &pos, std::vector<double> &theta);
+        bool QueuePosition(const Point &pos, const std::chrono::steady_clock::time_point &time);
+        bool QueueAngles(const std::chrono::steady_clock::time_point &time,
+                         const JointVector &theta,
+                         const JointVector &velocity = JointVector(),
+                         const JointVector &acceleration = JointVector());
+
+        void ForwardKinematics(Point &pos, const JointVector &theta);
+        void ForwardKinematics(kinematics::Transform &pose, const JointVector &theta);
+        /* theta is the starting guess, returns the position residual in meters */
+        double InverseKinematics(const Point &pos, JointVector &theta);
+
+        /* Structure of arrays versions for whole trajectories, theta[id] points to
+         * the count angles of joint id, its first value is the starting guess of the
+         * inverse kinematics which returns the number of unsolvable points */
+        void ForwardKinematicsBatch(const double *const *theta, const size_t &count,
+                                    double *x, double *y, double *z);
+        size_t InverseKinematicsBatch(const double *x, const double *y, const double *z,
+                                      const size_t &count, double *const *theta);
 
         void EnableTrainingMode(void);
+
+        /* Overruns, CPU time and wake-up latencies of the shared control executor,
+         * when enabled */
+        unsigned long long GetMissedDeadlines(void);
+        double GetCPUTime(void);
+        toolbox::histogram &GetWakeupLatencies(void);
+
+        std::shared_ptr<RoboticJointBase> GetJoint(const int &id);
+
     private:
         const int _joints_nr;
         /* A container of joints form a chain, 
@@ -72,9 +223,26 @@ class RoboticArm
          * :
          * joints[n] = nodeN
          */
-        std::vector<std::shared_ptr<RoboticJoint>> joints;
+        std::vector<std::shared_ptr<RoboticJointBase>> joints;
+
+        /* Geometry of the chain from the DH table of the configuration */
+        const kinematics::Chain<config::joints_nr> _chain;
+        /* Planar chains of 1 or 2 joints have a closed form solution */
+        bool _analytic_ik;
 
         void CalibrateMovement(void);
         void CalibratePosition(void);
+
+        /* Optional single thread control of all the joints */
+        void StartControlExecutor(void);
+        void ControlExecutor(void);
+        std::thread ControlExecutorThread;
+        std::atomic<bool> _executor_stop_event;
+        std::atomic<bool> _executor_running;
+        std::atomic<unsigned long long> _executor_missed_deadlines;
+        toolbox::histogram _executor_wakeup_latencies;
+
+        /* Shared memory rings the joint loops record into, when enabled */
+        std::shared_ptr<TelemetrySegment> _telemetry;
 };
 
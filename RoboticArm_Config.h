@@ -1,4 +1,6 @@
 #pragma once
+#include <cstddef>
+#include <sched.h>
 /*
  * Please use the following file for any pin or configuration
  * definitions, this will be dependency injected into the source
@@ -46,16 +48,100 @@ namespace config
     /* The physical length of each of the links in meters */
     static constexpr double link_lengths[] = { 0.012, 0.010 };
 
+    /* Denavit-Hartenberg table of the chain, one row per joint given as
+     * { a (m), alpha (rad), d (m), theta offset (rad) }, a planar RR arm */
+    static constexpr double dh_parameters[][4] = {{ link_lengths[0], 0, 0, 0 },
+                                                  { link_lengths[1], 0, 0, 0 }};
+
+    /* Numerical inverse kinematics, used unless the chain is a planar RR arm:
+     * iterations budget, starting damping (m) and target residual (m) */
+    static constexpr int ik_max_iterations = 64;
+    static constexpr double ik_damping = 1E-03;
+    static constexpr double ik_tolerance = 1E-07;
+
     /* Pair of pins used for these elements */
     static constexpr int quad_encoder_pins[][2]  = {{ 49,  48}, { 41,  43}};
     static constexpr int dc_motor_pins[][2]      = {{  0,   1}, {  2,   3}};
     
+    /* How each motor PWM is driven, MMIO stores to the mapped controller registers */
+    enum class MotorDriver { SYSFS, MMIO };
+    static constexpr MotorDriver dc_motor_drivers[] = {MotorDriver::SYSFS, MotorDriver::SYSFS};
+
+    /* Register block of the PWM controller used by MMIO motors, the Edison PWM
+     * PCI function, a regular file can stand in for it to try it elsewhere */
+    static constexpr char dc_motor_mmio_device[] = "/sys/bus/pci/devices/0000:00:17.0/resource0";
+    static constexpr long dc_motor_mmio_offset = 0;
+
+    /* Speed changes (in % of the range) too small to be written to the motors */
+    static constexpr double dc_motor_deadband_percent[] = {0.1, 0.1};
+    
     /* All of the joints will utilize the same webcam port in this case */
     static constexpr int visual_encoder_ports[] = {0, 0};
+
+    /* Position sensor of each joint, VISUAL requires a VISUAL_ENCODER build */
+    enum class JointSensor { QUADRATURE, VISUAL };
+    static constexpr JointSensor joint_sensors[] = {JointSensor::QUADRATURE, JointSensor::QUADRATURE};
     
     /* Physical characteristics of the encoders being used */
     static constexpr long quad_encoder_segments[] = {64 * 29, 48 * 75};
 
+    /* Time span of the edges used for the encoders velocity estimates */
+    static constexpr long quad_encoder_velocity_window_us[] = {10000, 10000};
+
+    /* Angular controller gains of each joint as { kp, ki, kd, kv, ka, ks } */
+    static constexpr double pid_gains[][6] = {{ 0.80, 0.20, 0.02, 0.0, 0.0, 4.0},
+                                              { 0.80, 0.20, 0.02, 0.0, 0.0, 4.0}};
+
+    /* Integral term clamp in % of speed, and derivative filter cut-off */
+    static constexpr double pid_integral_limits[] = {20.0, 20.0};
+    static constexpr double pid_derivative_cutoff_hz[] = {50.0, 50.0};
+
+    /* Rate of each joint control loop, a value of 0 makes it free running */
+    static constexpr int control_loop_rate_hz = 1000;
+
+    /* Event driven control, instead of running at the rate above each joint loop
+     * sleeps until its encoder moved by this many counts or a reference is due,
+     * and never longer than the maximum period. Needs a thread per joint, the
+     * shared executor always runs at the fixed rate */
+    static constexpr bool event_driven_control = false;
+    static constexpr long event_wake_counts[] = {1, 1};
+    static constexpr long event_max_period_us = 10000;
+
+    /* Pending timestamped references per joint, must be a power of two */
+    static constexpr unsigned setpoint_queue_depth = 256;
+
+    /* Per iteration records of every joint loop, in a POSIX shared memory
+     * segment read by robot-arm-telemetry.app, an empty name disables them */
+    static constexpr char telemetry_shm_name[] = "/robotic-arm-telemetry";
+    /* Records kept per joint, must be a power of two (~8s at 1 kHz) */
+    static constexpr unsigned telemetry_depth = 8192;
+
+    /* Scheduling of the real-time threads as { policy, priority, CPU }, the
+     * priority only counts for SCHED_FIFO and SCHED_RR and a CPU of -1 leaves
+     * the thread free to run anywhere. The encoder edge threads preempt the
+     * control loops, and keeping both on separate cores avoids it altogether.
+     * Free running control loops (a rate of 0) are always kept on SCHED_OTHER */
+    struct ThreadScheduling { int policy; int priority; int cpu; };
+    static constexpr ThreadScheduling control_thread_scheduling[] = {{SCHED_FIFO, 80, 1}, {SCHED_FIFO, 80, 1}};
+    static constexpr ThreadScheduling encoder_thread_scheduling[] = {{SCHED_FIFO, 90, 0}, {SCHED_FIFO, 90, 0}};
+
+    /* Keep every page of the process in RAM, and fault in this much of the
+     * stack of each real-time thread before it starts its work */
+    static constexpr bool lock_memory = true;
+    static constexpr size_t thread_stack_prefault = 64 * 1024;
+
+    /* Run all of the joints control laws on one thread, scheduled as above */
+    static constexpr bool shared_control_thread = false;
+    static constexpr ThreadScheduling shared_control_scheduling = {SCHED_FIFO, 80, 1};
+
+    /* Simulated plant of each joint, only used when built with SIMULATED_PLANT:
+     * { gear ratio, motor free speed (RPM), motor stall torque (N*m),
+     *   motor inertia (kg*m^2), load inertia at the output (kg*m^2),
+     *   static, Coulomb (N*m) and viscous (N*m*s/rad) motor frictions } */
+    static constexpr double sim_plant_parameters[][8] = {{ 29, 10150, 0.0287, 1.5E-07, 2E-04, 0.0040, 0.0030, 2E-07},
+                                                         { 75, 10125, 0.0288, 1.5E-07, 2E-04, 0.0040, 0.0030, 2E-07}};
+    static constexpr int sim_plant_rate_hz = 10000;
+
     /* Calculate number of joints based of motors */
     static constexpr int joints_nr = sizeof(dc_motor_pins)/sizeof(dc_motor_pins[0]);
 }
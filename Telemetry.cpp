@@ -0,0 +1,211 @@
+/*
+ * The following class keeps what every joint control loop did on each
+ * iteration in a POSIX shared memory segment, so any other process can
+ * follow the loops live, or look at their last seconds after the fact,
+ * without the arm having to be rebuilt with debug prints.
+ *
+ * Each joint owns a ring of fixed-size records with a single writer, a
+ * record is copied into its slot and then published by moving the head
+ * index with a release store. Readers copy the slots they want, then read
+ * the head again and throw away whatever the writer may have wrapped onto
+ * in the meantime, in the same spirit as a sequence lock.
+ *
+ * References:
+ * https://man7.org/linux/man-pages/man7/shm_overview.7.html
+ * https://www.kernel.org/doc/html/latest/locking/seqlock.html
+ *
+ */
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <new>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Telemetry.h"
+
+/* Every ring starts with its head index alone in a cache line */
+#define ring_head_size (size_t)64
+
+
+static_assert(sizeof(TelemetryHeader) == 64, "TelemetryHeader must take 64 bytes");
+static_assert(sizeof(TelemetryRecord) == 64, "TelemetryRecord must take 64 bytes");
+
+
+TelemetrySegment::TelemetrySegment(const std::string &name,
+                                   const unsigned &joints_nr,
+                                   const unsigned &depth,
+                                   const unsigned &rate_hz) :
+    _fd(-1),
+    _base(MAP_FAILED),
+    _size(0),
+    _header(NULL)
+{
+    if ((joints_nr == 0) || (depth == 0) || (depth & (depth - 1))) {
+        throw std::runtime_error("Telemetry needs joints and a power of two depth");
+    }
+
+    _fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (_fd < 0) {
+        throw std::runtime_error("Unable to create the telemetry segment " + name + ": " + std::strerror(errno));
+    }
+
+    _size = sizeof(TelemetryHeader) + joints_nr * (ring_head_size + depth * sizeof(TelemetryRecord));
+    if (ftruncate(_fd, _size) != 0) {
+        close(_fd);
+        throw std::runtime_error("Unable to size the telemetry segment " + name + ": " + std::strerror(errno));
+    }
+
+    Map(name, PROT_READ | PROT_WRITE);
+
+    /* Readers of a previous run see no magic until everything is reset */
+    std::memset(_header, 0, sizeof(*_header));
+    _header->version = telemetry_version;
+    _header->joints_nr = joints_nr;
+    _header->depth = depth;
+    _header->record_size = sizeof(TelemetryRecord);
+    _header->rate_hz = rate_hz;
+    for(unsigned joint = 0; joint < joints_nr; joint++) {
+        new (Head(joint)) std::atomic<uint64_t>(0);
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(_header->magic, telemetry_magic, sizeof(_header->magic));
+}
+
+
+TelemetrySegment::TelemetrySegment(const std::string &name) :
+    _fd(-1),
+    _base(MAP_FAILED),
+    _size(0),
+    _header(NULL)
+{
+    _fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (_fd < 0) {
+        throw std::runtime_error("Unable to open the telemetry segment " + name + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if ((fstat(_fd, &st) != 0) || ((size_t)st.st_size < sizeof(TelemetryHeader))) {
+        close(_fd);
+        throw std::runtime_error("The telemetry segment " + name + " is too small");
+    }
+    _size = st.st_size;
+
+    Map(name, PROT_READ);
+
+    const TelemetryHeader &header = *_header;
+    const size_t expected = sizeof(TelemetryHeader) +
+                            header.joints_nr * (ring_head_size + (size_t)header.depth * sizeof(TelemetryRecord));
+
+    if ((std::memcmp(header.magic, telemetry_magic, sizeof(header.magic)) != 0) ||
+        (header.version != telemetry_version) ||
+        (header.record_size != sizeof(TelemetryRecord)) ||
+        (header.depth == 0) || (header.depth & (header.depth - 1)) ||
+        (expected > _size)) {
+        munmap(_base, _size);
+        close(_fd);
+        throw std::runtime_error("The telemetry segment " + name + " is not valid");
+    }
+}
+
+
+TelemetrySegment::~TelemetrySegment(void)
+{
+    /* The segment itself stays, so the last records can still be read */
+    munmap(_base, _size);
+    close(_fd);
+}
+
+
+void TelemetrySegment::Map(const std::string &name, const int &prot)
+{
+    /* Populated up front, the control loops must not take page faults on it */
+    _base = mmap(NULL, _size, prot, MAP_SHARED | MAP_POPULATE, _fd, 0);
+    if (_base == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("Unable to map the telemetry segment " + name + ": " + std::strerror(errno));
+    }
+    _header = static_cast<TelemetryHeader *>(_base);
+}
+
+
+const TelemetryHeader &TelemetrySegment::GetHeader(void) const
+{
+    return *_header;
+}
+
+
+std::atomic<uint64_t> *TelemetrySegment::Head(const unsigned &joint) const
+{
+    char *ring = static_cast<char *>(_base) + sizeof(TelemetryHeader) +
+                 joint * (ring_head_size + (size_t)_header->depth * sizeof(TelemetryRecord));
+    return reinterpret_cast<std::atomic<uint64_t> *>(ring);
+}
+
+
+TelemetryRecord *TelemetrySegment::Records(const unsigned &joint) const
+{
+    return reinterpret_cast<TelemetryRecord *>(reinterpret_cast<char *>(Head(joint)) + ring_head_size);
+}
+
+
+uint64_t TelemetrySegment::GetHead(const unsigned &joint) const
+{
+    return Head(joint)->load(std::memory_order_acquire);
+}
+
+
+void TelemetrySegment::Push(const unsigned &joint, TelemetryRecord &record)
+{
+    std::atomic<uint64_t> *head = Head(joint);
+    const uint64_t sequence = head->load(std::memory_order_relaxed);
+
+    record.sequence = sequence;
+    record.joint = joint;
+    Records(joint)[sequence & (_header->depth - 1)] = record;
+
+    head->store(sequence + 1, std::memory_order_release);
+}
+
+
+size_t TelemetrySegment::Read(const unsigned &joint, uint64_t &cursor,
+                              TelemetryRecord *records, const size_t &count,
+                              unsigned long long &lost) const
+{
+    const uint64_t depth = _header->depth;
+    const TelemetryRecord *slots = Records(joint);
+    uint64_t head = Head(joint)->load(std::memory_order_acquire);
+
+    /* The arm was restarted under us, start over from its oldest record */
+    if (cursor > head) cursor = 0;
+
+    /* Too far behind, the oldest records are already gone */
+    if (head - cursor > depth) {
+        lost += head - depth - cursor;
+        cursor = head - depth;
+    }
+
+    size_t copied = std::min<uint64_t>(head - cursor, count);
+    for(size_t i = 0; i < copied; i++) {
+        std::memcpy(&records[i], &slots[(cursor + i) & (depth - 1)], sizeof(TelemetryRecord));
+    }
+
+    /* Anything the writer could have started to overwrite during the copy is torn */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    head = Head(joint)->load(std::memory_order_relaxed);
+
+    const uint64_t oldest = (head >= depth) ? head - depth + 1 : 0;
+    size_t torn = 0;
+    if (cursor < oldest) torn = std::min<uint64_t>(oldest - cursor, copied);
+    if (torn) {
+        std::memmove(records, records + torn, (copied - torn) * sizeof(TelemetryRecord));
+        lost += torn;
+    }
+
+    cursor += copied;
+    return copied - torn;
+}
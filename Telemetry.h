@@ -0,0 +1,102 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <stdint.h>
+
+/*
+ * Shared memory telemetry segment layout, one segment for the whole arm:
+ *
+ *   +=================+===============================================+
+ *   | TelemetryHeader | 64 bytes, see below                           |
+ *   +-----------------+-----------------------------------------------+
+ *   | Ring of joint 0 | 64 bytes holding the head index, then depth   |
+ *   |                 | TelemetryRecord slots of 64 bytes each        |
+ *   | Ring of joint 1 | ...                                           |
+ *   | :               |                                               |
+ *   +=================+===============================================+
+ *
+ * Every ring has a single writer, the control loop of its joint, which
+ * never waits for anybody: the oldest records are simply overwritten.
+ * Readers map the segment read only and chase the head index on their
+ * own, so they never write to a cache line the control loops use.
+ */
+
+#define telemetry_magic "RTLM"
+#define telemetry_version 1
+
+
+struct TelemetryHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t joints_nr;
+    /* Records kept per joint, a power of two */
+    uint32_t depth;
+    /* Size of each record in bytes */
+    uint32_t record_size;
+    /* Nominal rate of the control loops, 0 when free running */
+    uint32_t rate_hz;
+    uint32_t reserved[11];
+};
+
+
+struct TelemetryRecord
+{
+    /* Index of the record in the ring of its joint, counting from 0 */
+    uint64_t sequence;
+    /* Sampling instant of the iteration, CLOCK_MONOTONIC nanoseconds */
+    uint64_t timestamp_ns;
+    /* Degrees, reference minus measured for the error */
+    double reference, measured, error;
+    /* Signed actuation effort in % of speed, positive is CCW */
+    double effort;
+    /* Time since the previous iteration, and from the sampling instant
+     * until the actuator was written, in nanoseconds */
+    uint32_t period_ns;
+    uint32_t compute_ns;
+    uint32_t joint;
+    uint32_t reserved;
+};
+
+
+class TelemetrySegment
+{
+    public:
+        /* Creates the segment, or resets an existing one, for the control loops */
+        explicit TelemetrySegment(const std::string &name,
+                                  const unsigned &joints_nr,
+                                  const unsigned &depth,
+                                  const unsigned &rate_hz);
+        /* Maps a segment created by a running arm, read only */
+        explicit TelemetrySegment(const std::string &name);
+        virtual ~TelemetrySegment(void);
+
+        /* Unmapped and closed on destruction, a copy would be left dangling */
+        TelemetrySegment(const TelemetrySegment &) = delete;
+        TelemetrySegment &operator=(const TelemetrySegment &) = delete;
+
+        const TelemetryHeader &GetHeader(void) const;
+
+        /* Writer side, only ever called by the control loop of the joint */
+        void Push(const unsigned &joint, TelemetryRecord &record);
+
+        /* Reader side, copies up to count records from cursor onward and moves
+         * it past them. Records overwritten before they could be copied are
+         * skipped and added to lost, returns how many records were copied */
+        size_t Read(const unsigned &joint, uint64_t &cursor,
+                    TelemetryRecord *records, const size_t &count,
+                    unsigned long long &lost) const;
+
+        /* Index the next record of the joint will take */
+        uint64_t GetHead(const unsigned &joint) const;
+
+    private:
+        int _fd;
+        void *_base;
+        size_t _size;
+        TelemetryHeader *_header;
+
+        void Map(const std::string &name, const int &prot);
+        std::atomic<uint64_t> *Head(const unsigned &joint) const;
+        TelemetryRecord *Records(const unsigned &joint) const;
+};
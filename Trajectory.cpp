@@ -0,0 +1,250 @@
+/* 
+ * The following class turns a recorded list of timestamped positions
+ * into a smooth joint space reference for the robotic arm.
+ *
+ * Every point is solved with inverse kinematics only once, in a single
+ * batch when the trajectory gets loaded, then a cubic Hermite segment is
+ * fit between each pair of knots using finite difference (Catmull-Rom) tangents, so
+ * position and velocity are continuous across knots. Playback samples the
+ * curve at the control loop rate and queues every sample with its absolute
+ * due time, the joints pick them up on their own tick and nothing drifts.
+ *
+ * References:
+ * https://en.wikipedia.org/wiki/Cubic_Hermite_spline
+ * http://www.diag.uniroma1.it/~deluca/rob1_en/14_TrajectoryPlanning.pdf
+ *
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "toolbox.h"
+#include "Trajectory.h"
+#include "RoboticArm_Config.h"
+
+/* Sampling rate used when the control loops are free running */
+#define default_sample_rate_hz 1000
+
+
+Trajectory::Trajectory(void) : _segment(0)
+{
+    return;
+}
+
+
+Trajectory::~Trajectory(void)
+{
+    return;
+}
+
+
+void Trajectory::Load(RoboticArm &arm, const std::vector<std::pair<Point, double>> &points)
+{
+    std::vector<double> x, y, z, t;
+
+    for(auto &point_and_time : points) {
+        x.push_back(point_and_time.first.x);
+        y.push_back(point_and_time.first.y);
+        z.push_back(point_and_time.first.z);
+        t.push_back(point_and_time.second);
+    }
+
+    LoadCartesian(arm, x, y, z, t);
+}
+
+
+void Trajectory::Load(RoboticArm &arm, const TrajectoryReader &file)
+{
+    /* Recorded joint angles from this same arm spare us the IK */
+    if (file.GetHeader().joints_nr != config::joints_nr) {
+        std::vector<double> x, y, z, t;
+
+        for(size_t n = 0; n < file.GetSize(); n++) {
+            const TrajectoryRecord &record = file.GetRecord(n);
+            x.push_back(record.x);
+            y.push_back(record.y);
+            z.push_back(record.z);
+            t.push_back(record.t);
+        }
+
+        LoadCartesian(arm, x, y, z, t);
+        return;
+    }
+
+    JointVector theta;
+
+    Clear();
+
+    for(size_t n = 0; n < file.GetSize(); n++) {
+        const double *angles = file.GetAngles(n);
+        std::copy(angles, angles + config::joints_nr, theta.begin());
+        AddKnot(file.GetRecord(n).t, theta);
+    }
+
+    ComputeTangents();
+}
+
+
+void Trajectory::LoadCartesian(RoboticArm &arm,
+                               const std::vector<double> &x,
+                               const std::vector<double> &y,
+                               const std::vector<double> &z,
+                               const std::vector<double> &t)
+{
+    const size_t count = t.size();
+
+    /* Every point is solved in one pass, unsolvable points keep the
+     * previous solution and the first one starts from home */
+    std::vector<std::vector<double>> angles(config::joints_nr, std::vector<double>(count, 0));
+    double *columns[config::joints_nr];
+    for(auto id = 0; id < config::joints_nr; id++) columns[id] = angles[id].data();
+
+    const size_t unsolved = arm.InverseKinematicsBatch(x.data(), y.data(), z.data(), count, columns);
+    if (unsolved) {
+        logger << "W: " << unsolved << " trajectory points are not achievable by this robot" << std::endl;
+    }
+
+    JointVector theta;
+
+    Clear();
+
+    for(size_t n = 0; n < count; n++) {
+        for(auto id = 0; id < config::joints_nr; id++) theta[id] = angles[id][n];
+        AddKnot(t[n], theta);
+    }
+
+    ComputeTangents();
+}
+
+
+void Trajectory::Clear(void)
+{
+    _times.clear();
+    _knots.clear();
+    _tangents.clear();
+    _segment = 0;
+}
+
+
+void Trajectory::AddKnot(const double &t, JointVector &theta)
+{
+    /* Knots sharing a timestamp would produce empty segments */
+    if (!_times.empty() && (t <= _times.back())) return;
+
+    /* Unwrap the angles so we never interpolate the long way around */
+    if (!_knots.empty()) {
+        const auto &previous = _knots.back();
+        for(auto id = 0; id < config::joints_nr; id++) {
+            theta[id] = previous[id] + std::remainder(theta[id] - previous[id], 2 * M_PI);
+        }
+    }
+
+    _times.push_back(t);
+    _knots.push_back(theta);
+}
+
+
+void Trajectory::ComputeTangents(void)
+{
+    /* Finite difference tangents, the path starts and ends at rest */
+    _tangents.assign(_knots.size(), JointVector());
+    for(size_t k = 1; k + 1 < _knots.size(); k++) {
+        for(auto id = 0; id < config::joints_nr; id++) {
+            _tangents[k][id] = (_knots[k + 1][id] - _knots[k - 1][id]) /
+                               (_times[k + 1] - _times[k - 1]);
+        }
+    }
+
+    logger << "I: Trajectory has " << _knots.size() << " knots over "
+           << GetDuration() << " seconds" << std::endl;
+}
+
+
+double Trajectory::GetDuration(void)
+{
+    if (_times.size() < 2) return 0;
+    return _times.back() - _times.front();
+}
+
+
+void Trajectory::Sample(const double &t,
+                        JointVector &theta,
+                        JointVector &velocity,
+                        JointVector &acceleration)
+{
+    theta.fill(0);
+    velocity.fill(0);
+    acceleration.fill(0);
+
+    if (_knots.empty()) return;
+
+    /* Hold the end points outside of the time span */
+    const double time = t + _times.front();
+    if (time <= _times.front() || _knots.size() < 2) {
+        theta = _knots.front();
+        return;
+    }
+    if (time >= _times.back()) {
+        theta = _knots.back();
+        return;
+    }
+
+    /* Locate the segment, searching forward from the last one used */
+    if (time < _times[_segment]) _segment = 0;
+    while (time >= _times[_segment + 1]) _segment++;
+
+    const auto k = _segment;
+    const double h = _times[k + 1] - _times[k];
+    const double s = (time - _times[k]) / h;
+    const double s2 = s * s;
+    const double s3 = s2 * s;
+
+    /* Hermite basis functions and their first and second derivatives */
+    const double h00 = 2 * s3 - 3 * s2 + 1, h10 = s3 - 2 * s2 + s;
+    const double h01 = -2 * s3 + 3 * s2,    h11 = s3 - s2;
+    const double d00 = 6 * s2 - 6 * s,      d10 = 3 * s2 - 4 * s + 1;
+    const double d01 = -6 * s2 + 6 * s,     d11 = 3 * s2 - 2 * s;
+    const double a00 = 12 * s - 6,          a10 = 6 * s - 4;
+    const double a01 = -12 * s + 6,         a11 = 6 * s - 2;
+
+    for(auto id = 0; id < config::joints_nr; id++) {
+        const double p0 = _knots[k][id], p1 = _knots[k + 1][id];
+        const double m0 = _tangents[k][id] * h, m1 = _tangents[k + 1][id] * h;
+
+        theta[id]        = h00 * p0 + h10 * m0 + h01 * p1 + h11 * m1;
+        velocity[id]     = (d00 * p0 + d10 * m0 + d01 * p1 + d11 * m1) / h;
+        acceleration[id] = (a00 * p0 + a10 * m0 + a01 * p1 + a11 * m1) / (h * h);
+    }
+}
+
+
+void Trajectory::Play(RoboticArm &arm)
+{
+    const int rate_hz = (config::control_loop_rate_hz > 0) ? config::control_loop_rate_hz
+                                                           : default_sample_rate_hz;
+    const auto period = std::chrono::nanoseconds((long)(1E09 / rate_hz));
+    const long samples = (long)std::ceil(GetDuration() * rate_hz);
+
+    /* Working buffers, on the stack for the whole playback */
+    JointVector theta, velocity, acceleration;
+
+    /* Every sample is due at an absolute time from the beginning */
+    const auto start_time = std::chrono::steady_clock::now() + period;
+    auto due_time = start_time;
+
+    for(long n = 0; n <= samples; n++) {
+
+        due_time = start_time + n * period;
+        Sample(n / (double)rate_hz, theta, velocity, acceleration);
+
+        /* Run ahead of the joints as far as their queues allow, then nap */
+        while(!arm.QueueAngles(due_time, theta, velocity, acceleration)) {
+            std::this_thread::sleep_for(period * (config::setpoint_queue_depth / 2));
+        }
+
+    }
+
+    /* Let the last sample play out before returning */
+    std::this_thread::sleep_until(due_time);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include "RoboticArm.h"
+#include "TrajectoryFile.h"
+
+
+class Trajectory
+{
+    public:
+        explicit Trajectory(void);
+        virtual ~Trajectory(void);
+
+        /* Converts timestamped Cartesian points into joint space knots */
+        void Load(RoboticArm &arm, const std::vector<std::pair<Point, double>> &points);
+        void Load(RoboticArm &arm, const TrajectoryReader &file);
+        double GetDuration(void);
+
+        /* Joint space interpolation at t seconds from the beginning */
+        void Sample(const double &t,
+                    JointVector &theta,
+                    JointVector &velocity,
+                    JointVector &acceleration);
+
+        /* Streams the whole path into the arm at the control rate, blocks until done */
+        void Play(RoboticArm &arm);
+
+    private:
+        /* Knot times in seconds, and joint angles in radians per knot */
+        std::vector<double> _times;
+        std::vector<JointVector> _knots;
+        /* Joint space velocities at each knot, used by the cubic segments */
+        std::vector<JointVector> _tangents;
+
+        void Clear(void);
+        void LoadCartesian(RoboticArm &arm,
+                           const std::vector<double> &x,
+                           const std::vector<double> &y,
+                           const std::vector<double> &z,
+                           const std::vector<double> &t);
+        void AddKnot(const double &t, JointVector &theta);
+        void ComputeTangents(void);
+
+        /* Last segment visited, samples are mostly requested in order */
+        size_t _segment;
+};
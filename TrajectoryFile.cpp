@@ -0,0 +1,304 @@
+/* 
+ * The following classes read and write trajectory recordings in a
+ * compact binary format, so long recordings can be loaded instantly
+ * by mapping them in memory instead of parsing text line by line.
+ *
+ * The writer appends fixed-size records into an in-memory buffer that
+ * is only written to the file once it is full, keeping the sampling
+ * loop of the recorder away from the file system most of the time.
+ *
+ * The original text format ("x y z t" per line) is still supported
+ * and can be converted to the binary one.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "toolbox.h"
+#include "TrajectoryFile.h"
+
+/* Amount of records that get accumulated before hitting the file system */
+#define writer_buffer_size (size_t)(64 * 1024)
+
+/* How long the background writer naps when there is nothing to write */
+#define writer_idle_period std::chrono::milliseconds(10)
+
+
+TrajectoryWriter::TrajectoryWriter(const std::string &file,
+                                   const unsigned &rate_hz,
+                                   const unsigned &joints_nr) :
+    _buffer(writer_buffer_size),
+    _buffer_used(0)
+{
+    std::memset(&_header, 0, sizeof(_header));
+    std::memcpy(_header.magic, trajectory_file_magic, sizeof(_header.magic));
+    _header.version = trajectory_file_version;
+    _header.joints_nr = joints_nr;
+    _header.rate_hz = rate_hz;
+    _header.units = 0;
+    _header.record_size = sizeof(TrajectoryRecord) + joints_nr * sizeof(double);
+
+    _fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) {
+        throw std::runtime_error("Unable to create the trajectory file " + file);
+    }
+
+    if (write(_fd, &_header, sizeof(_header)) != (ssize_t)sizeof(_header)) {
+        close(_fd);
+        throw std::runtime_error("Unable to write the trajectory file header");
+    }
+}
+
+
+TrajectoryWriter::~TrajectoryWriter(void)
+{
+    Flush();
+    close(_fd);
+}
+
+
+void TrajectoryWriter::Append(const Point &pos, const double &t, const double *theta)
+{
+    /* Make room first, records are never split across writes */
+    if (_buffer_used + _header.record_size > _buffer.size()) Flush();
+
+    TrajectoryRecord record = { pos.x, pos.y, pos.z, t };
+    char *destination = &_buffer[_buffer_used];
+
+    std::memcpy(destination, &record, sizeof(record));
+    if (theta && _header.joints_nr) {
+        std::memcpy(destination + sizeof(record), theta, _header.joints_nr * sizeof(double));
+    }
+
+    _buffer_used += _header.record_size;
+}
+
+
+void TrajectoryWriter::Flush(void)
+{
+    size_t offset = 0;
+
+    while (offset < _buffer_used) {
+        const ssize_t written = write(_fd, &_buffer[offset], _buffer_used - offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            logger << "E: Failed to write the trajectory file, dropping records" << std::endl;
+            break;
+        }
+        offset += written;
+    }
+
+    _buffer_used = 0;
+}
+
+
+AsyncTrajectoryWriter::AsyncTrajectoryWriter(const std::string &file, const unsigned &rate_hz) :
+    _writer(file, rate_hz, config::joints_nr),
+    _dropped(0),
+    _writer_thread_stop_event(false)
+{
+    WriterThread = std::thread(&AsyncTrajectoryWriter::WriterLoop, this);
+}
+
+
+AsyncTrajectoryWriter::~AsyncTrajectoryWriter(void)
+{
+    /* The writer drains whatever is left before exiting */
+    if (WriterThread.joinable()) {
+        _writer_thread_stop_event = true;
+        WriterThread.join();
+    }
+
+    if (_dropped) {
+        logger << "W: " << _dropped << " trajectory samples were dropped" << std::endl;
+    }
+}
+
+
+bool AsyncTrajectoryWriter::Append(const Point &pos, const double &t, const double *theta)
+{
+    Sample sample;
+
+    sample.pos = pos;
+    sample.t = t;
+    std::memcpy(sample.theta, theta, sizeof(sample.theta));
+
+    if (!_samples.push(sample)) {
+        _dropped++;
+        return false;
+    }
+
+    return true;
+}
+
+
+unsigned long long AsyncTrajectoryWriter::GetDropped(void)
+{
+    return _dropped;
+}
+
+
+void AsyncTrajectoryWriter::WriterLoop(void)
+{
+    Sample sample;
+
+    for(;;) {
+
+        /* Sampled before draining, so nothing pushed before a stop is lost */
+        const bool stop = _writer_thread_stop_event;
+
+        /* Batch everything available into the file buffer */
+        while (_samples.pop(sample)) {
+            _writer.Append(sample.pos, sample.t, sample.theta);
+        }
+
+        if (stop) break;
+
+        std::this_thread::sleep_for(writer_idle_period);
+    }
+
+    _writer.Flush();
+}
+
+
+TrajectoryReader::TrajectoryReader(const std::string &file)
+{
+    struct stat info;
+
+    const int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open the trajectory file " + file);
+    }
+
+    if ((fstat(fd, &info) != 0) || ((size_t)info.st_size < sizeof(TrajectoryHeader))) {
+        close(fd);
+        throw std::runtime_error("Trajectory file is too small to be valid");
+    }
+
+    _mapping_size = info.st_size;
+    void *mapping = mmap(NULL, _mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* The mapping stays valid after closing its descriptor */
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Unable to map the trajectory file in memory");
+    }
+
+    /* Playback walks the records in order, let the kernel read ahead */
+    madvise(mapping, _mapping_size, MADV_SEQUENTIAL);
+
+    _mapping = (const char *)mapping;
+    _header = (const TrajectoryHeader *)_mapping;
+
+    if ((std::memcmp(_header->magic, trajectory_file_magic, sizeof(_header->magic)) != 0) ||
+        (_header->version != trajectory_file_version) ||
+        (_header->record_size != sizeof(TrajectoryRecord) + _header->joints_nr * sizeof(double))) {
+        munmap(mapping, _mapping_size);
+        throw std::runtime_error("Not a supported binary trajectory file");
+    }
+
+    /* A partial record at the end means the recording was cut short */
+    _records = (_mapping_size - sizeof(TrajectoryHeader)) / _header->record_size;
+}
+
+
+TrajectoryReader::~TrajectoryReader(void)
+{
+    munmap((void *)_mapping, _mapping_size);
+}
+
+
+bool TrajectoryReader::IsBinary(const std::string &file)
+{
+    char magic[4];
+    std::ifstream infile(file, std::ios::binary);
+
+    if (!infile.read(magic, sizeof(magic))) return false;
+    return (std::memcmp(magic, trajectory_file_magic, sizeof(magic)) == 0);
+}
+
+
+const TrajectoryHeader &TrajectoryReader::GetHeader(void) const
+{
+    return *_header;
+}
+
+
+size_t TrajectoryReader::GetSize(void) const
+{
+    return _records;
+}
+
+
+const TrajectoryRecord &TrajectoryReader::GetRecord(const size_t &n) const
+{
+    return *(const TrajectoryRecord *)(_mapping + sizeof(TrajectoryHeader) + n * _header->record_size);
+}
+
+
+const double *TrajectoryReader::GetAngles(const size_t &n) const
+{
+    if (_header->joints_nr == 0) return NULL;
+    return (const double *)((const char *)&GetRecord(n) + sizeof(TrajectoryRecord));
+}
+
+
+bool ParseTrajectoryText(const std::string &file, std::vector<std::pair<Point, double>> &trajectory)
+{
+    std::string line;
+    std::ifstream infile(file);
+
+    if (!infile.is_open()) {
+        logger << "E: Failed to load the trajectory file" << std::endl;
+        return false;
+    }
+
+    while (std::getline(infile, line)) {
+
+        /* First 3 fields form the coordinates, last one is time in seconds */
+        Point p;
+        double t;
+        char *cursor = (char *)line.c_str(), *end;
+
+        p.x = std::strtod(cursor, &end); if (end == cursor) continue; cursor = end;
+        p.y = std::strtod(cursor, &end); if (end == cursor) continue; cursor = end;
+        p.z = std::strtod(cursor, &end); if (end == cursor) continue; cursor = end;
+        t   = std::strtod(cursor, &end); if (end == cursor) continue;
+
+        trajectory.push_back(std::make_pair(p, t));
+    }
+
+    return true;
+}
+
+
+bool ConvertTrajectoryText(const std::string &text_file, const std::string &binary_file)
+{
+    std::vector<std::pair<Point, double>> trajectory;
+
+    if (!ParseTrajectoryText(text_file, trajectory)) return false;
+
+    /* The text format has no rate, estimate it from the first two points */
+    unsigned rate_hz = 0;
+    if ((trajectory.size() > 1) && (trajectory[1].second > trajectory[0].second)) {
+        rate_hz = std::lround(1 / (trajectory[1].second - trajectory[0].second));
+    }
+
+    TrajectoryWriter writer(binary_file, rate_hz);
+    for (auto &point_and_time : trajectory) {
+        writer.Append(point_and_time.first, point_and_time.second);
+    }
+
+    logger << "I: Converted " << trajectory.size() << " points at ~" << rate_hz << "Hz" << std::endl;
+
+    return true;
+}
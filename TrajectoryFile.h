@@ -0,0 +1,135 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include "RoboticArm.h"
+
+/*
+ * Binary trajectory file layout, all values are little endian:
+ *
+ *   +==================+===========================================+
+ *   | TrajectoryHeader | 32 bytes, see below                       |
+ *   +------------------+-------------------------------------------+
+ *   | Record 0         | x, y, z, t doubles + joints_nr doubles    |
+ *   | Record 1         | ...                                       |
+ *   | :                |                                           |
+ *   +==================+===========================================+
+ *
+ * There is no record count on the header, it is derived from the file
+ * size so a recording that gets interrupted is still a valid file.
+ */
+
+#define trajectory_file_magic "RTRJ"
+#define trajectory_file_version 1
+
+
+struct TrajectoryHeader
+{
+    char magic[4];
+    uint16_t version;
+    /* Joint angles stored per record, 0 when only Cartesian */
+    uint16_t joints_nr;
+    /* Nominal sampling rate of the recording */
+    uint32_t rate_hz;
+    /* 0 = meters, seconds and radians, the only ones for now */
+    uint32_t units;
+    /* Size of each record in bytes, including the joint angles */
+    uint32_t record_size;
+    uint32_t reserved[3];
+};
+
+
+struct TrajectoryRecord
+{
+    double x, y, z, t;
+};
+
+
+class TrajectoryWriter
+{
+    public:
+        explicit TrajectoryWriter(const std::string &file,
+                                  const unsigned &rate_hz,
+                                  const unsigned &joints_nr = 0);
+        virtual ~TrajectoryWriter(void);
+
+        /* A copy would close the file under the other one */
+        TrajectoryWriter(const TrajectoryWriter &) = delete;
+        TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+        /* Buffered append, theta must hold joints_nr angles when used */
+        void Append(const Point &pos, const double &t, const double *theta = NULL);
+        void Flush(void);
+
+    private:
+        int _fd;
+        TrajectoryHeader _header;
+        std::vector<char> _buffer;
+        size_t _buffer_used;
+};
+
+
+class AsyncTrajectoryWriter
+{
+    public:
+        explicit AsyncTrajectoryWriter(const std::string &file, const unsigned &rate_hz);
+        virtual ~AsyncTrajectoryWriter(void);
+
+        /* Never blocks the caller, samples are dropped when the ring is full */
+        bool Append(const Point &pos, const double &t, const double *theta);
+        unsigned long long GetDropped(void);
+
+    private:
+        struct Sample {
+            Point pos;
+            double t;
+            double theta[config::joints_nr];
+        };
+
+        /* Only touched by the background thread */
+        TrajectoryWriter _writer;
+
+        /* Samples travel from the caller to the background thread */
+        toolbox::spsc_queue<Sample, 4096> _samples;
+        std::atomic<unsigned long long> _dropped;
+
+        void WriterLoop(void);
+        std::thread WriterThread;
+        std::atomic<bool> _writer_thread_stop_event;
+};
+
+
+class TrajectoryReader
+{
+    public:
+        explicit TrajectoryReader(const std::string &file);
+        virtual ~TrajectoryReader(void);
+
+        /* The mapping is released by whoever goes first, so no copies */
+        TrajectoryReader(const TrajectoryReader &) = delete;
+        TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+
+        /* Checks the magic so callers can fall back to the text format */
+        static bool IsBinary(const std::string &file);
+
+        const TrajectoryHeader &GetHeader(void) const;
+        size_t GetSize(void) const;
+        const TrajectoryRecord &GetRecord(const size_t &n) const;
+        /* Recorded joint angles of a record, NULL when not present */
+        const double *GetAngles(const size_t &n) const;
+
+    private:
+        /* The whole file is mapped, records are read in place */
+        const char *_mapping;
+        size_t _mapping_size;
+        const TrajectoryHeader *_header;
+        size_t _records;
+};
+
+
+/* Text format support, one "x y z t" line per point */
+bool ParseTrajectoryText(const std::string &file, std::vector<std::pair<Point, double>> &trajectory);
+bool ConvertTrajectoryText(const std::string &text_file, const std::string &binary_file);
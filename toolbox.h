@@ -1,15 +1,38 @@
 #pragma once
 #include <iostream>
+#include <iomanip>
 #include <chrono>
 #include <ctime>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <streambuf>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <ncurses.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <alloca.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
 
 #define appname "Robotic-Arm"
-#define logger std::cout << "[" << toolbox::timestamp().c_str() << "] " appname ": "
+/* Lines are committed on std::endl and printed by a background thread */
+#define logger toolbox::log_writer::local()
+/* Hands a string literal to the logger by address, anything else fails to build */
+#define log_literal(text) toolbox::log_literal_text{ "" text }
 
 namespace toolbox
 {
@@ -31,19 +54,840 @@ namespace toolbox
        return load;
     }
 
-    inline const std::string timestamp(void)
+    /* Used to run a loop on absolute deadlines of a fixed period, instead of
+     * relative sleeps that drift by the amount of work done on each cycle
+     */
+    class periodic_timer {
+        public:
+            explicit periodic_timer(const long &period_ns) : _period_ns(period_ns), _latency_ns(0)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &_deadline);
+            }
+
+            /* Sleeps until the next release time, returns false on overruns */
+            bool wait(void)
+            {
+                struct timespec now;
+
+                advance(_deadline, _period_ns);
+                clock_gettime(CLOCK_MONOTONIC, &now);
+
+                if ((now.tv_sec > _deadline.tv_sec) ||
+                    (now.tv_sec == _deadline.tv_sec && now.tv_nsec > _deadline.tv_nsec)) {
+                    /* Missed our release time, re-synchronize to skip the backlog */
+                    _latency_ns = elapsed(_deadline, now);
+                    _deadline = now;
+                    return false;
+                }
+
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &_deadline, NULL) == EINTR);
+
+                /* How late the kernel woke us up, as cyclictest measures it */
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                _latency_ns = elapsed(_deadline, now);
+                return true;
+            }
+
+            /* Nanoseconds between the last release time and the return of wait */
+            long latency(void) const { return _latency_ns; }
+
+        private:
+            const long _period_ns;
+            long _latency_ns;
+            struct timespec _deadline;
+
+            static long elapsed(const struct timespec &from, const struct timespec &to)
+            {
+                return std::max(0L, (to.tv_sec - from.tv_sec) * 1000000000L + (to.tv_nsec - from.tv_nsec));
+            }
+
+            static void advance(struct timespec &t, const long &ns)
+            {
+                t.tv_nsec += ns;
+                while (t.tv_nsec >= 1000000000L) {
+                    t.tv_nsec -= 1000000000L;
+                    t.tv_sec++;
+                }
+            }
+    };
+
+    /* Lets a thread sleep until another one signals it, or until a timeout,
+     * on a futex. Signalling takes no system call while nobody is waiting,
+     * and keeps the time of what triggered it to account for the wake-up
+     */
+    class wakeup_event {
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "The futex word must be 32 bits");
+
+        public:
+            explicit wakeup_event(void) : _sequence(0), _waiters(0), _signal_ns(0) {}
+
+            /* timestamp_ns is when, in CLOCK_MONOTONIC, the reason to wake up happened */
+            void signal(const long long &timestamp_ns)
+            {
+                _signal_ns.store(timestamp_ns, std::memory_order_relaxed);
+                _sequence.fetch_add(1, std::memory_order_seq_cst);
+                if (_waiters.load(std::memory_order_seq_cst)) {
+                    syscall(SYS_futex, &_sequence, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+                }
+            }
+
+            /* Taken before looking for work, any signal after it ends the next wait */
+            uint32_t sequence(void) const { return _sequence.load(std::memory_order_acquire); }
+
+            /* Sleeps for up to timeout_ns unless signalled since seen, returns true if it was */
+            bool wait(const uint32_t &seen, const long &timeout_ns)
+            {
+                struct timespec deadline;
+                bool signalled;
+
+                clock_gettime(CLOCK_MONOTONIC, &deadline);
+                deadline.tv_sec += timeout_ns / 1000000000L;
+                deadline.tv_nsec += timeout_ns % 1000000000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_nsec -= 1000000000L;
+                    deadline.tv_sec++;
+                }
+
+                _waiters.fetch_add(1, std::memory_order_seq_cst);
+                while (!(signalled = (_sequence.load(std::memory_order_seq_cst) != seen))) {
+                    /* Absolute deadline on CLOCK_MONOTONIC, EINTR and EAGAIN check again */
+                    if ((syscall(SYS_futex, &_sequence, FUTEX_WAIT_BITSET_PRIVATE, seen, &deadline,
+                                 NULL, FUTEX_BITSET_MATCH_ANY) != 0) && (errno == ETIMEDOUT)) break;
+                }
+                _waiters.fetch_sub(1, std::memory_order_relaxed);
+
+                return signalled;
+            }
+
+            /* Timestamp given to the last signal, in nanoseconds */
+            long long signal_time(void) const { return _signal_ns.load(std::memory_order_relaxed); }
+
+        private:
+            std::atomic<uint32_t> _sequence;
+            std::atomic<int> _waiters;
+            std::atomic<long long> _signal_ns;
+    };
+
+    /* Lock-free single producer, single consumer ring buffer, the producer
+     * only ever writes the head and the consumer only ever writes the tail.
+     * N must be a power of two so the indexes can wrap with a mask.
+     */
+    template <class T, size_t N>
+    class spsc_queue {
+        static_assert((N > 0) && ((N & (N - 1)) == 0), "Queue size must be a power of two");
+
+        public:
+            explicit spsc_queue(void) : _head(0), _tail(0) {}
+
+            /* Producer side, returns false when there is no room left */
+            bool push(const T &item)
+            {
+                const size_t head = _head.load(std::memory_order_relaxed);
+                if (head - _tail.load(std::memory_order_acquire) == N) return false;
+                _buffer[head & (N - 1)] = item;
+                _head.store(head + 1, std::memory_order_release);
+                return true;
+            }
+
+            /* Consumer side, peek at the oldest element without removing it */
+            T *front(void)
+            {
+                const size_t tail = _tail.load(std::memory_order_relaxed);
+                if (tail == _head.load(std::memory_order_acquire)) return NULL;
+                return &_buffer[tail & (N - 1)];
+            }
+
+            /* Consumer side, returns false when there is nothing to take */
+            bool pop(T &item)
+            {
+                T *oldest = front();
+                if (oldest == NULL) return false;
+                item = *oldest;
+                _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                return true;
+            }
+
+            /* Consumer side, drops the element returned by front() */
+            void pop(void)
+            {
+                _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            /* Safe from either side, the producer sees a lower bound of the space */
+            size_t size(void) const
+            {
+                return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+            }
+
+            size_t space(void) const { return N - size(); }
+
+        private:
+            /* Keep each index in its own cache line to avoid false sharing */
+            std::atomic<size_t> _head;
+            char _head_padding[64 - sizeof(std::atomic<size_t>)];
+            std::atomic<size_t> _tail;
+            char _tail_padding[64 - sizeof(std::atomic<size_t>)];
+            T _buffer[N];
+    };
+
+    /* Severity of a log line, taken from its "D: ", "I: ", "W: " or "E: " prefix */
+    enum class log_level : uint8_t { debug, info, warning, error };
+
+    /* One line of the log on its way from a thread to the drain. Arguments
+     * stay binary until the drain thread formats them, each one is a tag
+     * byte followed by its value, string literals travel by their address.
+     */
+    struct log_record
+    {
+        static constexpr size_t payload_size = 244;
+
+        enum tag : uint8_t { literal, text, signed_int, unsigned_int, real, character,
+                             boolean, flags, width, precision, fill };
+
+        uint64_t timestamp_ns;
+        uint16_t length;
+        log_level level;
+        bool truncated;
+        unsigned char payload[payload_size];
+    };
+
+    /* Records of a single thread, only that thread ever pushes into it */
+    struct log_ring
     {
-        time_t now = time(0);
-        struct tm tstruct;
-        char buf[80];
-        tstruct = *localtime(&now);
-        // Visit http://en.cppreference.com/w/cpp/chrono/c/strftime
-        // for more information about date/time format
-        strftime(buf, sizeof(buf), "%X", &tstruct);
-    
-        return buf;
+        static constexpr size_t depth = 256;
+
+        explicit log_ring(void) : dropped(0), orphaned(false) {}
+
+        spsc_queue<log_record, depth> records;
+        /* Lines lost because the drain could not keep up */
+        std::atomic<uint64_t> dropped;
+        /* Its thread is gone, released once everything was printed */
+        std::atomic<bool> orphaned;
+    };
+
+    /* Owns the rings of every thread and the thread that prints them, in
+     * timestamp order, to std::cout. Lines committed after the process
+     * started exiting are printed right away by the calling thread.
+     */
+    class log_core {
+        public:
+            static log_core &instance(void)
+            {
+                /* Never destroyed, threads still running at exit may log */
+                static log_core *core = new log_core();
+                return *core;
+            }
+
+            std::shared_ptr<log_ring> attach(void)
+            {
+                std::shared_ptr<log_ring> ring(new log_ring());
+                std::lock_guard<std::mutex> lock(_lock);
+                _rings.push_back(ring);
+                return ring;
+            }
+
+            void commit(log_ring &ring, const log_record &record)
+            {
+                if (_synchronous) {
+                    std::lock_guard<std::mutex> lock(_lock);
+                    print(record);
+                    std::cout.flush();
+                } else if (!ring.records.push(record)) {
+                    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            log_level threshold(void) const { return _threshold.load(std::memory_order_relaxed); }
+            void set_threshold(const log_level &level) { _threshold = level; }
+
+            /* Level named by the first letter of a line, lines without one are informative */
+            static log_level level_of(const char *text)
+            {
+                if ((text == nullptr) || (text[0] == '\0') || (text[1] != ':')) return log_level::info;
+                switch (text[0]) {
+                    case 'D': return log_level::debug;
+                    case 'W': return log_level::warning;
+                    case 'E': return log_level::error;
+                    default:  return log_level::info;
+                }
+            }
+
+        private:
+            /* How long the drain sleeps once it has emptied every ring */
+            static constexpr long drain_period_ms = 10;
+
+            std::mutex _lock;
+            std::vector<std::shared_ptr<log_ring>> _rings;
+            std::atomic<log_level> _threshold;
+            std::atomic<bool> _drain_stop_event;
+            std::atomic<bool> _synchronous;
+            /* Converts the monotonic timestamps back to the time of day */
+            int64_t _realtime_offset_ns;
+            std::thread _drain_thread;
+
+            explicit log_core(void) : _drain_stop_event(false), _synchronous(false)
+            {
+                /* ROBOTIC_ARM_LOG_LEVEL=D, I, W or E overrides the build default */
+                const char *level = std::getenv("ROBOTIC_ARM_LOG_LEVEL");
+                char prefix[3] = { 'I', ':', '\0' };
+#ifdef DEBUG
+                prefix[0] = 'D';
+#endif
+                if (level && level[0]) prefix[0] = level[0];
+                _threshold = level_of(prefix);
+                struct timespec realtime, monotonic;
+                clock_gettime(CLOCK_REALTIME, &realtime);
+                clock_gettime(CLOCK_MONOTONIC, &monotonic);
+                _realtime_offset_ns = (realtime.tv_sec - monotonic.tv_sec) * 1000000000LL +
+                                      (realtime.tv_nsec - monotonic.tv_nsec);
+
+                _drain_thread = std::thread(&log_core::drain_loop, this);
+                std::atexit([]() { instance().stop(); });
+            }
+
+            void stop(void)
+            {
+                _drain_stop_event = true;
+                if (_drain_thread.joinable()) _drain_thread.join();
+
+                std::lock_guard<std::mutex> lock(_lock);
+                drain();
+                _synchronous = true;
+            }
+
+            void drain_loop(void)
+            {
+                while (!_drain_stop_event) {
+                    {
+                        std::lock_guard<std::mutex> lock(_lock);
+                        drain();
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds((long)drain_period_ms));
+                }
+            }
+
+            /* Prints everything queued so far, oldest line first, holding the lock */
+            void drain(void)
+            {
+                bool printed = false;
+
+                for (;;) {
+                    log_ring *oldest = nullptr;
+                    for (auto &ring : _rings) {
+                        const log_record *front = ring->records.front();
+                        if ((front != nullptr) &&
+                            ((oldest == nullptr) || (front->timestamp_ns < oldest->records.front()->timestamp_ns))) {
+                            oldest = ring.get();
+                        }
+                    }
+                    if (oldest == nullptr) break;
+
+                    print(*oldest->records.front());
+                    oldest->records.pop();
+                    printed = true;
+                }
+
+                for (size_t i = 0; i < _rings.size(); i++) {
+                    const uint64_t dropped = _rings[i]->dropped.exchange(0, std::memory_order_relaxed);
+                    if (dropped) {
+                        print_prefix(now_ns());
+                        std::cout << "W: " << dropped << " log lines were dropped, the drain fell behind\n";
+                        printed = true;
+                    }
+                    /* Exited threads never push again, so an empty ring is done */
+                    if (_rings[i]->orphaned && (_rings[i]->records.size() == 0)) {
+                        _rings[i] = _rings.back();
+                        _rings.pop_back();
+                        i--;
+                    }
+                }
+
+                if (printed) std::cout.flush();
+            }
+
+            static uint64_t now_ns(void)
+            {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                return now.tv_sec * 1000000000ULL + now.tv_nsec;
+            }
+
+            void print_prefix(const uint64_t &timestamp_ns)
+            {
+                const int64_t realtime_ns = timestamp_ns + _realtime_offset_ns;
+                const time_t seconds = realtime_ns / 1000000000LL;
+                struct tm tstruct;
+                char stamp[32];
+
+                localtime_r(&seconds, &tstruct);
+                const size_t length = strftime(stamp, sizeof(stamp), "%X", &tstruct);
+                snprintf(stamp + length, sizeof(stamp) - length, ".%06ld",
+                         (long)(realtime_ns % 1000000000LL) / 1000);
+
+                std::cout << "[" << stamp << "] " appname ": ";
+            }
+
+            /* Replays the arguments onto std::cout, manipulators stick like they used to */
+            void print(const log_record &record)
+            {
+                const unsigned char *p = record.payload;
+                const unsigned char *const end = record.payload + record.length;
+
+                print_prefix(record.timestamp_ns);
+
+                while (p < end) {
+                    const uint8_t tag = *p++;
+                    switch (tag) {
+                        case log_record::literal: {
+                            const char *text;
+                            std::memcpy(&text, p, sizeof(text));
+                            p += sizeof(text);
+                            std::cout << text;
+                            break;
+                        }
+                        case log_record::text:
+                            std::cout << (const char *)p;
+                            p += std::strlen((const char *)p) + 1;
+                            break;
+                        case log_record::signed_int:
+                            std::cout << load<long long>(p);
+                            break;
+                        case log_record::unsigned_int:
+                            std::cout << load<unsigned long long>(p);
+                            break;
+                        case log_record::real:
+                            std::cout << load<double>(p);
+                            break;
+                        case log_record::character:
+                            std::cout << load<char>(p);
+                            break;
+                        case log_record::boolean:
+                            std::cout << load<bool>(p);
+                            break;
+                        case log_record::flags:
+                            std::cout << load<std::ios_base &(*)(std::ios_base &)>(p);
+                            break;
+                        case log_record::width:
+                            std::cout.width(load<int>(p));
+                            break;
+                        case log_record::precision:
+                            std::cout.precision(load<int>(p));
+                            break;
+                        case log_record::fill:
+                            std::cout.fill(load<char>(p));
+                            break;
+                        default:
+                            p = end;
+                    }
+                }
+
+                if (record.truncated) std::cout << "...";
+                std::cout << '\n';
+            }
+
+            template <class T>
+            static T load(const unsigned char *&p)
+            {
+                T value;
+                std::memcpy(&value, p, sizeof(value));
+                p += sizeof(value);
+                return value;
+            }
+    };
+
+    /* Only ever made by the log_literal macro, so the text outlives the record */
+    struct log_literal_text { const char *text; };
+
+    /* Per thread builder behind the logger macro, every << appends a binary
+     * argument to the pending record and std::endl hands it to the thread's
+     * ring, nothing is formatted and no lock is taken along the way. Lines
+     * below the runtime level are dropped as soon as their prefix is seen.
+     *
+     * Text is copied into the record, it may be gone by the time the drain
+     * thread gets to it. Only string literals wrapped in log_literal() are
+     * kept by address, for the lines logged from the control loops.
+     */
+    class log_writer {
+        public:
+            static log_writer &local(void)
+            {
+                /* A plain pointer outlives the thread_local objects, so lines
+                 * logged from static destructors at exit still find a writer */
+                static thread_local log_writer *writer = nullptr;
+                if (writer == nullptr) {
+                    writer = new log_writer();
+                    static thread_local release_on_exit release(writer);
+                }
+                return *writer;
+            }
+
+            template <size_t N>
+            log_writer &operator<<(const char (&text)[N])
+            {
+                if (begin(text)) put((const char *)text);
+                return *this;
+            }
+
+            log_writer &operator<<(const log_literal_text &literal)
+            {
+                if (begin(literal.text)) append(log_record::literal, literal.text);
+                return *this;
+            }
+
+            template <size_t N>
+            log_writer &operator<<(char (&text)[N])
+            {
+                if (begin(text)) put((const char *)text);
+                return *this;
+            }
+
+            template <class T>
+            log_writer &operator<<(const T &value)
+            {
+                if (begin(nullptr)) put(value);
+                return *this;
+            }
+
+            log_writer &operator<<(std::ios_base &(*manipulator)(std::ios_base &))
+            {
+                if (begin(nullptr)) append(log_record::flags, manipulator);
+                return *this;
+            }
+
+            /* std::endl ends the line, any other stream manipulator is ignored */
+            log_writer &operator<<(std::ostream &(*manipulator)(std::ostream &))
+            {
+                if (manipulator != static_cast<std::ostream &(*)(std::ostream &)>(std::endl)) return *this;
+
+                if (begin(nullptr)) log_core::instance().commit(*_ring, _record);
+                _pending = false;
+                return *this;
+            }
+
+        private:
+            /* Formats the arguments the record has no tag for, straight into it */
+            class payload_buffer : public std::streambuf {
+                public:
+                    void reset(char *begin, char *end) { setp(begin, end); }
+                    size_t written(void) const { return pptr() - pbase(); }
+            };
+
+            struct release_on_exit {
+                log_writer *&writer;
+                explicit release_on_exit(log_writer *&w) : writer(w) {}
+                ~release_on_exit() { delete writer; writer = nullptr; }
+            };
+
+            std::shared_ptr<log_ring> _ring;
+            log_record _record;
+            bool _pending, _discard;
+            payload_buffer _buffer;
+            std::ostream _formatter;
+
+            explicit log_writer(void) :
+                _ring(log_core::instance().attach()), _pending(false), _discard(false), _formatter(&_buffer) {}
+
+            ~log_writer(void) { _ring->orphaned = true; }
+
+            /* Opens the record on its first argument, returns false while it is filtered out */
+            bool begin(const char *first)
+            {
+                if (!_pending) {
+                    _pending = true;
+                    _record.level = log_core::level_of(first);
+                    _discard = (_record.level < log_core::instance().threshold());
+                    if (_discard) return false;
+
+                    struct timespec now;
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    _record.timestamp_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+                    _record.length = 0;
+                    _record.truncated = false;
+                }
+                return !_discard;
+            }
+
+            /* Reserves room for a tag and its value, marks the record truncated once it is full */
+            unsigned char *reserve(const uint8_t &tag, const size_t &size)
+            {
+                if (_record.truncated || (_record.length + 1 + size > log_record::payload_size)) {
+                    _record.truncated = true;
+                    return nullptr;
+                }
+                unsigned char *p = _record.payload + _record.length;
+                *p = tag;
+                _record.length += 1 + size;
+                return p + 1;
+            }
+
+            template <class T>
+            void append(const uint8_t &tag, const T &value)
+            {
+                unsigned char *p = reserve(tag, sizeof(value));
+                if (p) std::memcpy(p, &value, sizeof(value));
+            }
+
+            void put(bool value)               { append(log_record::boolean, value); }
+            void put(char value)               { append(log_record::character, value); }
+            void put(signed char value)        { append(log_record::character, (char)value); }
+            void put(unsigned char value)      { append(log_record::character, (char)value); }
+            void put(short value)              { append(log_record::signed_int, (long long)value); }
+            void put(int value)                { append(log_record::signed_int, (long long)value); }
+            void put(long value)               { append(log_record::signed_int, (long long)value); }
+            void put(long long value)          { append(log_record::signed_int, value); }
+            void put(unsigned short value)     { append(log_record::unsigned_int, (unsigned long long)value); }
+            void put(unsigned value)           { append(log_record::unsigned_int, (unsigned long long)value); }
+            void put(unsigned long value)      { append(log_record::unsigned_int, (unsigned long long)value); }
+            void put(unsigned long long value) { append(log_record::unsigned_int, value); }
+            void put(float value)              { append(log_record::real, (double)value); }
+            void put(double value)             { append(log_record::real, value); }
+            void put(long double value)        { append(log_record::real, (double)value); }
+            void put(char *text)               { put((const char *)text); }
+            void put(const std::string &text)  { put(text.c_str()); }
+
+            void put(const char *text)
+            {
+                if (text == nullptr) text = "(null)";
+
+                /* As much of the text as fits, behind its tag and before its terminator */
+                const size_t length = std::strlen(text);
+                const size_t room = log_record::payload_size - _record.length;
+                const size_t copied = (room > 2) ? std::min(length, room - 2) : 0;
+
+                unsigned char *p = reserve(log_record::text, copied + 1);
+                if (p == nullptr) return;
+                std::memcpy(p, text, copied);
+                p[copied] = '\0';
+                if (copied < length) _record.truncated = true;
+            }
+
+            template <class T>
+            void put(const std::atomic<T> &value) { put(value.load()); }
+
+            void put(const decltype(std::setw(0)) &manipulator)
+            {
+                _formatter << manipulator;
+                append(log_record::width, (int)_formatter.width(0));
+            }
+
+            void put(const decltype(std::setprecision(0)) &manipulator)
+            {
+                const std::streamsize precision = _formatter.precision();
+                _formatter << manipulator;
+                append(log_record::precision, (int)_formatter.precision(precision));
+            }
+
+            void put(const decltype(std::setfill('0')) &manipulator)
+            {
+                const char fill = _formatter.fill();
+                _formatter << manipulator;
+                append(log_record::fill, _formatter.fill(fill));
+            }
+
+            /* Anything else with an operator<< is formatted as text, at the call site */
+            template <class T>
+            void put(const T &value)
+            {
+                /* Room for the terminator at least, the text grows into the rest */
+                unsigned char *p = reserve(log_record::text, 1);
+                if (p == nullptr) return;
+
+                char *begin = (char *)p;
+                _buffer.reset(begin, (char *)_record.payload + log_record::payload_size - 1);
+                _formatter.clear();
+                _formatter << value;
+
+                const size_t length = _buffer.written();
+                begin[length] = '\0';
+                _record.length += length;
+                if (!_formatter) _record.truncated = true;
+            }
+    };
+
+    /* Lines below this level are dropped by every thread from now on */
+    inline void set_log_level(const log_level &level)
+    {
+        log_core::instance().set_threshold(level);
+    }
+
+    /* CPU time consumed so far by a thread, in seconds */
+    inline double thread_cpu_time(const pthread_t &thread)
+    {
+        clockid_t clock;
+        struct timespec t;
+
+        if (pthread_getcpuclockid(thread, &clock) != 0) return 0;
+        if (clock_gettime(clock, &t) != 0) return 0;
+        return t.tv_sec + t.tv_nsec / 1E09;
+    }
+
+    /* Name of a scheduling policy, for the logs */
+    inline const char *policy_name(const int &policy)
+    {
+        switch (policy) {
+            case SCHED_FIFO:  return "SCHED_FIFO";
+            case SCHED_RR:    return "SCHED_RR";
+            case SCHED_OTHER: return "SCHED_OTHER";
+            default:          return "an unknown policy";
+        }
+    }
+
+    /* Moves a thread to a scheduling policy and pins it to a CPU, the priority
+     * only counts for SCHED_FIFO and SCHED_RR and a negative CPU leaves it
+     * unpinned. Failures are logged, returns false if anything was refused */
+    inline bool set_thread_scheduling(const std::string &name, const pthread_t &thread,
+                                      const int &policy, const int &priority, const int &cpu)
+    {
+        bool applied = true;
+
+        if (cpu >= 0) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+            if (pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset) != 0) {
+                logger << "W: Failed to pin the " << name << " thread to CPU " << cpu << std::endl;
+                applied = false;
+            }
+        }
+
+        struct sched_param sp;
+        sp.sched_priority = ((policy == SCHED_FIFO) || (policy == SCHED_RR)) ? priority : 0;
+        const int error = pthread_setschedparam(thread, policy, &sp);
+        if (error != 0) {
+            logger << "W: Failed to run the " << name << " thread on " << policy_name(policy)
+                   << " priority " << sp.sched_priority << ", " << std::strerror(error) << std::endl;
+            return false;
+        }
+
+        auto &line = logger << "I: The " << name << " thread runs on " << policy_name(policy)
+                            << " priority " << sp.sched_priority;
+        if (applied && (cpu >= 0)) line << " pinned to CPU " << cpu;
+        line << std::endl;
+        return applied;
+    }
+
+    /* Touches bytes worth of stack of the calling thread, so the pages it
+     * will grow into are faulted in now and not in the middle of a deadline */
+    __attribute__((noinline)) inline void prefault_stack(const size_t &bytes)
+    {
+        volatile unsigned char *stack = static_cast<volatile unsigned char *>(alloca(bytes));
+        const size_t page = sysconf(_SC_PAGESIZE);
+
+        for (size_t offset = 0; offset < bytes; offset += page) stack[offset] = 0;
+    }
+
+    /* Locks every current and future page of the process in RAM, then reads
+     * back from the kernel how much of it really is locked. Returns it in kB,
+     * or a negative errno when the lock was refused */
+    inline long lock_memory(void)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) return -errno;
+
+        FILE *status = fopen("/proc/self/status", "r");
+        if (status == NULL) return -errno;
+
+        char line[128];
+        long locked = 0;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmLck: %ld kB", &locked) == 1) break;
+        }
+        fclose(status);
+
+        return locked;
     }
-    
+
+    /* Log-linear histogram of nanosecond values, every power of two is split
+     * in 16 linear buckets so any recorded value is within ~6% of its bucket.
+     * Recording is wait-free, so it is safe to use from the real-time threads.
+     */
+    class histogram {
+        public:
+            static constexpr int sub_buckets = 16;
+            static constexpr int linear_limit = 2 * sub_buckets;
+            static constexpr int max_exponent = 40;
+            static constexpr int buckets = linear_limit + (max_exponent - 4) * sub_buckets;
+
+            explicit histogram(void) { reset(); }
+
+            void record(const uint64_t &value)
+            {
+                _counts[index(value)].fetch_add(1, std::memory_order_relaxed);
+                _total.fetch_add(1, std::memory_order_relaxed);
+                _sum.fetch_add(value, std::memory_order_relaxed);
+
+                uint64_t max = _max.load(std::memory_order_relaxed);
+                while ((value > max) && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+                uint64_t min = _min.load(std::memory_order_relaxed);
+                while ((value < min) && !_min.compare_exchange_weak(min, value, std::memory_order_relaxed));
+            }
+
+            void reset(void)
+            {
+                for (auto &count : _counts) count.store(0, std::memory_order_relaxed);
+                _total = 0;
+                _sum = 0;
+                _max = 0;
+                _min = UINT64_MAX;
+            }
+
+            uint64_t count(void) const { return _total; }
+            uint64_t max(void) const { return _max; }
+            uint64_t min(void) const { return _total ? _min.load() : 0; }
+            double mean(void) const { return _total ? _sum / (double)_total : 0; }
+
+            /* Upper bound of the bucket holding the requested percentile */
+            uint64_t percentile(const double &p) const
+            {
+                const uint64_t total = _total;
+                const uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+                uint64_t seen = 0;
+
+                if (total == 0) return 0;
+                for (auto i = 0; i < buckets; i++) {
+                    seen += _counts[i].load(std::memory_order_relaxed);
+                    if (seen >= rank && seen > 0) return std::min(upper_bound(i), max());
+                }
+                return max();
+            }
+
+        private:
+            std::atomic<uint64_t> _counts[buckets];
+            std::atomic<uint64_t> _total, _sum, _max, _min;
+
+            static int index(const uint64_t &value)
+            {
+                if (value < (uint64_t)linear_limit) return value;
+                const int exponent = std::min(63 - __builtin_clzll(value), (int)max_exponent);
+                const int mantissa = (value >> (exponent - 4)) & (sub_buckets - 1);
+                return std::min(linear_limit + (exponent - 5) * sub_buckets + mantissa, buckets - 1);
+            }
+
+            static uint64_t upper_bound(const int &i)
+            {
+                if (i < linear_limit) return i;
+                const int exponent = (i - linear_limit) / sub_buckets + 5;
+                const int mantissa = (i - linear_limit) % sub_buckets;
+                return ((uint64_t)(sub_buckets + mantissa + 1) << (exponent - 4)) - 1;
+            }
+    };
+
+    /* One line summary of a histogram of nanosecond latencies, in microseconds
+     * and laid out like the cyclictest one so runs are easy to compare, nothing
+     * is logged for a histogram that never recorded anything */
+    inline void log_latency(const std::string &name, const histogram &h)
+    {
+        if (h.count() == 0) return;
+        auto us = [](const uint64_t &ns) { return ns / 1E03; };
+
+        logger << "I: " << std::left << std::setw(28) << name << std::right
+               << " C:" << std::setw(9) << h.count() << std::fixed << std::setprecision(1)
+               << " Min:" << std::setw(8) << us(h.min())
+               << " Avg:" << std::setw(8) << h.mean() / 1E03
+               << " P99:" << std::setw(8) << us(h.percentile(99))
+               << " P99.9:" << std::setw(8) << us(h.percentile(99.9))
+               << " Max:" << std::setw(8) << us(h.max()) << " us" << std::endl;
+    }
+
     class ncursesbuf: public std::streambuf {
         public:
             explicit ncursesbuf() {}